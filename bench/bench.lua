@@ -0,0 +1,155 @@
+-- call overhead of dlffi against hand-written lua_CFunction baselines
+-- usage: lua bench.lua [iterations]
+-- output: tab separated benchmark, dlffi and baseline calls per second,
+--	and their ratio
+-- functions loaded by signature strings call through native stubs,
+--	DLFFI_JIT=0 in the environment measures them through libffi
+
+local dir = (arg and arg[0] or ""):match("^(.*/)") or "./";
+package.cpath = dir .. "?.so;" .. package.cpath;
+local dl = require("dlffi");
+local base = require("bench_baseline");
+
+local N = tonumber(arg and arg[1]) or tonumber(os.getenv("BENCH_N")) or 200000;
+local lib = dir .. "libdlffi_bench.so";
+local P, I, D = dl.ffi_type_pointer, dl.ffi_type_sint, dl.ffi_type_double;
+local L = dl.ffi_type_slong;
+
+-- {{{ load() - load a symbol or fail
+local function load(library, name, ret, args)
+	local f, e = dl.load(library, name, ret, args);
+	if not f then error(name .. ": " .. tostring(e)) end;
+	return f;
+end;
+-- }}} load()
+
+local nop = load(lib, "bench_nop", dl.ffi_type_void, {});
+local inc = load(lib, "bench_inc", I, { I });
+local add = load(lib, "bench_add", D, { D, D });
+local ptr = load(lib, "bench_ptr", P, { P, P });
+local sum8 = load(lib, "bench_sum8", L, { L, L, L, L, L, L, L, L });
+local cos = load("libm.so.6", "cos", D, { D });
+local sig_inc = load(lib, "bench_inc", "i(i)");
+local sig_add = load(lib, "bench_add", "d(dd)");
+local sig_ptr = load(lib, "bench_ptr", "p(pp)");
+local qsort = load("", "qsort", dl.ffi_type_void,
+	{ P, dl.ffi_type_size_t, dl.ffi_type_size_t, P });
+
+-- struct bench_wide of bench_lib.h
+local T = dl.Dlffi_t:new("wide", {
+	dl.ffi_type_schar, dl.ffi_type_sshort, I, L,
+	D, P, dl.ffi_type_schar, I,
+	L, dl.ffi_type_float, D, dl.ffi_type_sshort,
+	P, dl.ffi_type_schar, L, { "p", I },
+});
+T.int = { I };
+local wide = dl.dlffi_Pointer(dl.sizeof(T.wide), true);
+local wide_view = T:view("wide", wide);
+local bwide = base.wide_new();
+
+local ints = dl.dlffi_Pointer(4 * 256, true);
+local ints_view = ints:view(I, 256);
+local bints = base.ints_new(256);
+local shuffled = {};
+for i = 1, 256 do shuffled[i] = (i * 7919) % 256 end;
+ints_view:write(1, shuffled);
+base.ints_fill(bints, shuffled);
+local str = string.rep("benchmark", 7);
+local text = dl.dlffi_Pointer(#str + 1, true);
+text:view(dl.ffi_type_uchar, #str + 1):write(1, { string.byte(str .. "\0", 1, -1) });
+local btext = base.string_new(str);
+local compare = function(a, b)
+	return dl.type_element(a, T.int, 1) - dl.type_element(b, T.int, 1);
+end;
+
+-- {{{ benchmarks
+--	name, loop through dlffi, loop through the baseline, iterations
+local benchmarks = {
+{ "void()",
+	function(n) for _ = 1, n do nop() end end,
+	function(n) local f = base.nop; for _ = 1, n do f() end end },
+{ "int(int)",
+	function(n) for i = 1, n do inc(i) end end,
+	function(n) local f = base.inc; for i = 1, n do f(i) end end },
+{ "double(double,double)",
+	function(n) for i = 1, n do add(i, 0.5) end end,
+	function(n) local f = base.add; for i = 1, n do f(i, 0.5) end end },
+{ "pointer(pointer,string)",
+	function(n) for _ = 1, n do ptr(dl.NULL, "abc") end end,
+	function(n) local f = base.ptr; for _ = 1, n do f(dl.NULL, "abc") end end },
+{ "long(8 x long)",
+	function(n) for i = 1, n do sum8(i, 2, 3, 4, 5, 6, 7, 8) end end,
+	function(n)
+		local f = base.sum8;
+		for i = 1, n do f(i, 2, 3, 4, 5, 6, 7, 8) end;
+	end },
+{ "int(int) as \"i(i)\"",
+	function(n) for i = 1, n do sig_inc(i) end end,
+	function(n) local f = base.inc; for i = 1, n do f(i) end end },
+{ "double(double,double) as \"d(dd)\"",
+	function(n) for i = 1, n do sig_add(i, 0.5) end end,
+	function(n) local f = base.add; for i = 1, n do f(i, 0.5) end end },
+{ "pointer(pointer,string) as \"p(pp)\"",
+	function(n) for _ = 1, n do sig_ptr(dl.NULL, "abc") end end,
+	function(n) local f = base.ptr; for _ = 1, n do f(dl.NULL, "abc") end end },
+{ "libm cos(double)",
+	function(n) for i = 1, n do cos(i) end end,
+	function(n) local f = base.cos; for i = 1, n do f(i) end end },
+{ "type_element read",
+	function(n)
+		local t = T.wide;
+		for _ = 1, n do dl.type_element(wide, t, 16) end;
+	end,
+	function(n) local f = base.wide_get; for _ = 1, n do f(bwide) end end },
+{ "type_element write",
+	function(n)
+		local t = T.wide;
+		for i = 1, n do dl.type_element(wide, t, 16, i) end;
+	end,
+	function(n) local f = base.wide_set; for i = 1, n do f(bwide, i) end end },
+{ "struct view read",
+	function(n) for _ = 1, n do local _ = wide_view.p end end,
+	function(n) local f = base.wide_get; for _ = 1, n do f(bwide) end end },
+{ "Pointer:index",
+	function(n) for i = 1, n do ints:index(i % 256 + 1, I) end end,
+	function(n)
+		local f = base.index;
+		for i = 1, n do f(bints, i % 256 + 1) end;
+	end },
+{ "Pointer:tostring",
+	function(n) for _ = 1, n do text:tostring() end end,
+	function(n) local f = base.tostring; for _ = 1, n do f(btext) end end },
+{ "qsort(256) Lua comparator",
+	function(n)
+		local cmp = dl.load(compare, I, { P, P });
+		for _ = 1, n do
+			ints_view:write(1, shuffled);
+			qsort(ints, 256, 4, cmp);
+		end;
+	end,
+	function(n)
+		for _ = 1, n do
+			base.ints_fill(bints, shuffled);
+			base.qsort(bints, 256, compare);
+		end;
+	end, N // 1000 + 1 },
+};
+-- }}} benchmarks
+
+-- {{{ rate() - calls per second of the loop
+local function rate(loop, n)
+	collectgarbage();
+	local t = os.clock();
+	loop(n);
+	t = os.clock() - t;
+	if t <= 0 then return math.huge end;
+	return n / t;
+end;
+-- }}} rate()
+
+io.write("benchmark\tdlffi\tbaseline\tratio\n");
+for _, b in ipairs(benchmarks) do
+	local n = b[4] or N;
+	local x, y = rate(b[2], n), rate(b[3], n);
+	io.write(string.format("%s\t%.0f\t%.0f\t%.3f\n", b[1], x, y, x / y));
+end;
@@ -0,0 +1,150 @@
+/* hand-written lua_CFunction counterparts of the calls made by bench.lua */
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include "bench_lib.h"
+
+/* {{{ calls of the test library */
+static int b_nop(lua_State *L) {
+	(void)L;
+	bench_nop();
+	return 0;
+}
+
+static int b_inc(lua_State *L) {
+	lua_pushinteger(L, bench_inc((int)luaL_checkinteger(L, 1)));
+	return 1;
+}
+
+static int b_add(lua_State *L) {
+	lua_pushnumber(L,
+		bench_add(luaL_checknumber(L, 1), luaL_checknumber(L, 2)));
+	return 1;
+}
+
+static int b_ptr(lua_State *L) {
+	lua_pushlightuserdata(L,
+		bench_ptr(lua_touserdata(L, 1), luaL_checkstring(L, 2)));
+	return 1;
+}
+
+static int b_sum8(lua_State *L) {
+	lua_pushinteger(L, bench_sum8(
+		luaL_checkinteger(L, 1), luaL_checkinteger(L, 2),
+		luaL_checkinteger(L, 3), luaL_checkinteger(L, 4),
+		luaL_checkinteger(L, 5), luaL_checkinteger(L, 6),
+		luaL_checkinteger(L, 7), luaL_checkinteger(L, 8)
+	));
+	return 1;
+}
+
+static int b_cos(lua_State *L) {
+	lua_pushnumber(L, cos(luaL_checknumber(L, 1)));
+	return 1;
+}
+/* }}} calls of the test library */
+
+/* {{{ memory access */
+static int b_wide_new(lua_State *L) {
+	struct bench_wide *w = lua_newuserdata(L, sizeof(*w));
+	memset(w, 0, sizeof(*w));
+	return 1;
+}
+
+static int b_wide_get(lua_State *L) {
+	struct bench_wide *w = lua_touserdata(L, 1);
+	lua_pushinteger(L, w->p);
+	return 1;
+}
+
+static int b_wide_set(lua_State *L) {
+	struct bench_wide *w = lua_touserdata(L, 1);
+	w->p = (int)luaL_checkinteger(L, 2);
+	return 0;
+}
+
+static int b_ints_new(lua_State *L) {
+	size_t n = (size_t)luaL_checkinteger(L, 1);
+	memset(lua_newuserdata(L, n * sizeof(int)), 0, n * sizeof(int));
+	return 1;
+}
+
+static int b_ints_fill(lua_State *L) {
+	int *a = lua_touserdata(L, 1);
+	lua_Integer i, n = (lua_Integer)lua_rawlen(L, 2);
+	for (i = 1; i <= n; i++) {
+		lua_rawgeti(L, 2, i);
+		a[i - 1] = (int)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	return 0;
+}
+
+static int b_string_new(lua_State *L) {
+	size_t len;
+	const char *s = luaL_checklstring(L, 1, &len);
+	memcpy(lua_newuserdata(L, len + 1), s, len + 1);
+	return 1;
+}
+
+static int b_index(lua_State *L) {
+	int *a = lua_touserdata(L, 1);
+	lua_pushinteger(L, a[luaL_checkinteger(L, 2) - 1]);
+	return 1;
+}
+
+static int b_tostring(lua_State *L) {
+	lua_pushstring(L, lua_touserdata(L, 1));
+	return 1;
+}
+/* }}} memory access */
+
+/* {{{ qsort() with a Lua comparator */
+static lua_State *cmp_L;
+
+static int cmp(const void *a, const void *b) {
+	lua_pushvalue(cmp_L, 3);
+	lua_pushlightuserdata(cmp_L, (void *)a);
+	lua_pushlightuserdata(cmp_L, (void *)b);
+	lua_call(cmp_L, 2, 1);
+	int r = (int)lua_tointeger(cmp_L, -1);
+	lua_pop(cmp_L, 1);
+	return r;
+}
+
+static int b_qsort(lua_State *L) {
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+	cmp_L = L;
+	qsort(lua_touserdata(L, 1), luaL_checkinteger(L, 2), sizeof(int), cmp);
+	return 0;
+}
+/* }}} qsort() with a Lua comparator */
+
+static const struct luaL_Reg bench_baseline [] = {
+	{"nop", b_nop},
+	{"inc", b_inc},
+	{"add", b_add},
+	{"ptr", b_ptr},
+	{"sum8", b_sum8},
+	{"cos", b_cos},
+	{"wide_new", b_wide_new},
+	{"wide_get", b_wide_get},
+	{"wide_set", b_wide_set},
+	{"ints_new", b_ints_new},
+	{"ints_fill", b_ints_fill},
+	{"string_new", b_string_new},
+	{"index", b_index},
+	{"tostring", b_tostring},
+	{"qsort", b_qsort},
+	{NULL, NULL}
+};
+
+int luaopen_bench_baseline(lua_State *L) {
+	lua_newtable(L);
+	luaL_setfuncs(L, bench_baseline, 0);
+	return 1;
+}
+
+// vim: set foldmethod=marker:
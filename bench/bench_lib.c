@@ -0,0 +1,69 @@
+/* test library for bench.lua and test_jit.lua: trivial callees */
+#include "bench_lib.h"
+
+void bench_nop(void) {
+}
+
+int bench_inc(int a) {
+	return a + 1;
+}
+
+double bench_add(double a, double b) {
+	return a + b;
+}
+
+void *bench_ptr(void *p, const char *s) {
+	return (char *)p + (s[0] != '\0');
+}
+
+long bench_sum8(
+	long a, long b, long c, long d,
+	long e, long f, long g, long h
+) {
+	return a + b + c + d + e + f + g + h;
+}
+
+int bench_wide_get(struct bench_wide *w) {
+	return w->p;
+}
+
+void bench_wide_set(struct bench_wide *w, int v) {
+	w->p = v;
+}
+
+signed char bench_ret_c(int v) {
+	return (signed char)v;
+}
+
+unsigned char bench_ret_uc(int v) {
+	return (unsigned char)v;
+}
+
+short bench_ret_h(int v) {
+	return (short)v;
+}
+
+unsigned short bench_ret_uh(int v) {
+	return (unsigned short)v;
+}
+
+long bench_small(signed char a, unsigned char b, short c, unsigned short d) {
+	return a + 1000L * b + 1000000L * c + 1000000000000L * d;
+}
+
+float bench_fmul(float a, float b) {
+	return a * b;
+}
+
+double bench_fd(float a, double b) {
+	return a - b;
+}
+
+/* 6 integer and 8 SSE registers, each argument weighted by its position */
+double bench_regs(
+	long a, double b, int c, float d, long e, double f, signed char g,
+	float h, unsigned int i, double j, long k, double l, double m, float n
+) {
+	return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g +
+		8 * h + 9 * i + 10 * j + 11 * k + 12 * l + 13 * m + 14 * n;
+}
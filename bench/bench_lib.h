@@ -0,0 +1,45 @@
+#ifndef BENCH_LIB_H
+#define BENCH_LIB_H
+
+/* wide structure: 16 elements of mixed types, see bench.lua */
+struct bench_wide {
+	char a;
+	short b;
+	int c;
+	long d;
+	double e;
+	void *f;
+	char g;
+	int h;
+	long i;
+	float j;
+	double k;
+	short l;
+	void *m;
+	char n;
+	long o;
+	int p;
+};
+
+void bench_nop(void);
+int bench_inc(int a);
+double bench_add(double a, double b);
+void *bench_ptr(void *p, const char *s);
+long bench_sum8(long, long, long, long, long, long, long, long);
+int bench_wide_get(struct bench_wide *w);
+void bench_wide_set(struct bench_wide *w, int v);
+
+/* argument and return classes of the native call stubs, see test_jit.lua */
+signed char bench_ret_c(int v);
+unsigned char bench_ret_uc(int v);
+short bench_ret_h(int v);
+unsigned short bench_ret_uh(int v);
+long bench_small(signed char a, unsigned char b, short c, unsigned short d);
+float bench_fmul(float a, float b);
+double bench_fd(float a, double b);
+double bench_regs(
+	long a, double b, int c, float d, long e, double f, signed char g,
+	float h, unsigned int i, double j, long k, double l, double m, float n
+);
+
+#endif
@@ -0,0 +1,75 @@
+-- native call stubs against libffi for every argument and return class
+-- usage: lua test_jit.lua
+-- functions loaded by signature strings call through native stubs and are
+--	checked against the same functions loaded by type tables (libffi)
+--	and against the expected values; DLFFI_JIT=0 in the environment runs
+--	the signature loads through libffi as well
+
+local dir = (arg and arg[0] or ""):match("^(.*/)") or "./";
+package.cpath = dir .. "?.so;" .. package.cpath;
+local dl = require("dlffi");
+
+local lib = dir .. "libdlffi_bench.so";
+local c, C = dl.ffi_type_schar, dl.ffi_type_uchar;
+local h, H = dl.ffi_type_sshort, dl.ffi_type_ushort;
+local i, I = dl.ffi_type_sint, dl.ffi_type_uint;
+local l, f, d = dl.ffi_type_slong, dl.ffi_type_float, dl.ffi_type_double;
+
+-- {{{ load() - load a symbol or fail
+local function load(name, ret, args)
+	local fn, e = dl.load(lib, name, ret, args);
+	if not fn then error(name .. ": " .. tostring(e)) end;
+	return fn;
+end;
+-- }}} load()
+
+-- {{{ check() - call both loads of a symbol and compare to the expected value
+local function check(name, sig, ret, args, expect, ...)
+	local stub = load(name, sig);
+	local ffi = load(name, ret, args);
+	local a, b = stub(...), ffi(...);
+	assert(a == b, string.format("%s: %s (%s) ~= %s (ffi)",
+		name, tostring(a), sig, tostring(b)));
+	assert(a == expect, string.format("%s: %s, %s expected",
+		name, tostring(a), tostring(expect)));
+end;
+-- }}} check()
+
+-- returns are narrowed and extended by the callee type
+check("bench_ret_c", "c(i)", c, { i }, -56, 200);
+check("bench_ret_c", "c(i)", c, { i }, 127, 127);
+check("bench_ret_uc", "C(i)", C, { i }, 255, -1);
+check("bench_ret_uc", "C(i)", C, { i }, 44, 300);
+check("bench_ret_h", "h(i)", h, { i }, 4464, 70000);
+check("bench_ret_h", "h(i)", h, { i }, -32768, 32768);
+check("bench_ret_uh", "H(i)", H, { i }, 65535, -1);
+
+-- narrow arguments keep their sign
+check("bench_small", "l(cChH)", l, { c, C, h, H },
+	-5 + 1000 * 250 + 1000000 * -30000 + 1000000000000 * 65000,
+	-5, 250, -30000, 65000);
+check("bench_small", "l(cChH)", l, { c, C, h, H },
+	-128 + 1000 * 255 + 1000000 * -32768 + 1000000000000 * 65535,
+	-128, 255, -32768, 65535);
+
+-- float and double, exactly representable values
+check("bench_fmul", "f(ff)", f, { f, f }, -3.75, 1.5, -2.5);
+check("bench_fd", "d(fd)", d, { f, d }, 0.25 - 1e10, 0.25, 1e10);
+
+-- all 6 integer and 8 SSE argument registers, interleaved
+local regs = { 1, 0.5, -3, 2.25, 5, -6.5, -7, 8.125, 9, 10.75, 11, -12.5,
+	13.25, 14.5 };
+local expect = 0;
+for k, v in ipairs(regs) do expect = expect + k * v end;
+check("bench_regs", "d(ldifldcfIdlddf)", d,
+	{ l, d, i, f, l, d, c, f, I, d, l, d, d, f },
+	expect, table.unpack(regs));
+-- distinct magnitudes catch swapped float registers
+regs[6], regs[14] = 1e6, -1e6;
+expect = 0;
+for k, v in ipairs(regs) do expect = expect + k * v end;
+check("bench_regs", "d(ldifldcfIdlddf)", d,
+	{ l, d, i, f, l, d, c, f, I, d, l, d, d, f },
+	expect, table.unpack(regs));
+
+print("ok");
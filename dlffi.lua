@@ -14,142 +14,36 @@ local Dlffi_t = {}; -- types container
 local rawload = dl.load;
 dl.rawload = rawload;
 
-local memset, e = rawload("", "memset", dl.ffi_type_pointer,
-	{dl.ffi_type_pointer, dl.ffi_type_sint, dl.ffi_type_size_t} );
-assert(memset, e);
-
--- {{{ proxy for multi-return functions
-local multireturn = function(proxy, ...)
-	local arg = proxy.arg;
-	local ret = proxy.ret;
-	local struct = proxy.struct;
-	local symbol = proxy.symbol;
-	local val = {...};
-	local new_val = {};
-	-- {{{ substitute values with pointers
-	for i = 1, #val, 1 do new_val[i] = val[i] end;
-	for cx = 1, #ret, 1 do
-		local i = ret[cx];
-		local cur_v = new_val[i];
-		if not cur_v then
-			new_val[i] = dl.NULL;
-		else -- {{{ wrap value
-		local cur_t = arg[i];
-		-- create buffer
-		local buf, e = dl.dlffi_Pointer(
-			dl.sizeof(cur_t),
-			true
-		);
-		if not buf then return nil, e end;
-		-- initialize buffer if needed
-		if (cur_v == dl.NULL) then
-			-- bzero
-			memset(buf, 0, dl.sizeof(cur_t));
-		else
-			e = dl.type_element(
-				buf,
-				struct[cur_t],
-				1,
-				cur_v
-			);
-			if not e then return
-				nil,
-				string.format(
-					"type_element() failed for #%d",
-					i
-				);
-			end;
-		end;
-		-- substitute value
-		new_val[i] = buf;
-		end; -- }}} wrap value
-	end;
-	-- }}} substitute values with pointers
-	-- jump to original symbol
-	local retval, e = symbol(table.unpack(new_val));
-	if e then return false, e end;
-	-- get returned values
-	local retvals = {};
-	for cx = 1, #ret, 1 do
-		local i = ret[cx];
-		local buf = new_val[i];
-		if buf == dl.NULL then
-			table.insert(retvals, dl.NULL);
-		else -- {{{ unwrap value
-		local cur_t = arg[i];
-		e = dl.type_element(
-			buf,
-			struct[cur_t],
-			1
-		);
-		if not e then return nil,
-			"Return value unwrap failed";
-		end;
-		-- push return value
-		table.insert(retvals, e);
-		end; -- }}} unwrap value
-	end;
-	return true, retval, table.unpack(retvals);
-end;
--- }}} proxy for multi-return functions
-
 dl.load = function (lib, sym, ret, arg, cast)
 	-- if a dynamic symbol is loading
 	if type(lib) == "string" then
-		if not cast then cast = cast_table end;
+		-- a signature string like "p(ppi)" replaces ret and arg
+		if type(ret) == "string" then
+			return rawload(lib, sym, ret, nil, arg or "_val");
+		end;
+		-- the C loader reads the field as cast_table() does
+		if not cast then cast = "_val" end;
 		if type(ret) == "table" then
 			-- construct multi-return function
 			-- ret may look like
 			--	{ ret = ffi_type_pointer, 2, 3 }
 			--	ret["ret"] is required key
-			-- {{{ substitute given types with pointers
+			local symbol, e = rawload(lib, sym, ret.ret, arg, cast, ret);
+			if not symbol then return nil, e end;
+			-- the original symbol with a real prototype
 			local new_arg = {};
 			for i = 1, #arg, 1 do
 				new_arg[i] = arg[i];
 			end;
-			local struct = Dlffi_t:new();
-			if not struct then
-				return nil, "Dlffi_t:new() failed";
-			end;
 			for i = 1, #ret, 1 do
-				local v = ret[i];
-				local t = new_arg[v]
-				if not t then
-					return nil, string.format(
-						"Argument #%d does not exists",
-						i
-					);
-				end;
-				if not struct[t] then
-					struct[t] = { t };
-					if not struct[t] then
-						return nil, string.format(
-							"Structure #%d " ..
-							"construction failed",
-							i
-						);
-					end;
-				end;
-				new_arg[v] = dl.ffi_type_pointer;
+				new_arg[ret[i]] = dl.ffi_type_pointer;
 			end;
-			-- }}} substitute given types with pointers
-			-- load symbol with a real prototype
-			local symbol, e =
-				rawload(lib, sym, ret.ret, new_arg, cast);
-			if not symbol then return nil, e end;
-			-- {{{ make proxy object
-			local proxy = {};
-			local mt = {};
-			setmetatable(proxy, mt);
-			mt.__index = mt;
-			mt.__call = multireturn;
-			mt.arg = arg;
-			mt.ret = ret;
-			mt.struct = struct;
-			mt.symbol = symbol;
-			-- }}} make proxy object
-			-- return proxy and the original symbol
-			return proxy, symbol;
+			local raw;
+			raw, e = rawload(lib, sym, ret.ret, new_arg, cast);
+			if not raw then return nil, e end;
+			-- return the function and the original symbol, both are
+			-- dlffi_Function and may be passed as function pointers
+			return symbol, raw;
 		end;
 	end;
 	return rawload(lib, sym, ret, arg, cast);
@@ -161,45 +55,16 @@ end;
 --	name	- dynamic symbol name
 --	ffitype	- FFI type of the loading symbol
 local function loadsym(lib, name, ffitype)
-	local dlopen, e;
-	dlopen, e = dl.load(
-		"", "dlopen", dl.ffi_type_pointer,
-		{ dl.ffi_type_pointer, dl.ffi_type_sint }
-	);
-	if not dlopen then return nil, "dlopen(): " .. tostring(e) end;
-	local dlsym;
-	dlsym, e = dl.load(
-		"", "dlsym", dl.ffi_type_pointer,
-		{ dl.ffi_type_pointer, dl.ffi_type_pointer }
-	);
-	if not dlsym then return nil, "dlsym(): " .. tostring(e) end;
-	local dlclose;
-	dlclose, e = dl.load(
-		"", "dlclose", dl.ffi_type_sint,
-		{ dl.ffi_type_pointer }
-	);
-	if not dlclose then return nil, "dlclose(): " .. tostring(e) end;
-	local dlerror;
-	dlerror, e = dl.load(
-		"", "dlerror", dl.ffi_type_pointer,
-		{ }
-	);
-	if not dlerror then return nil, "dlerror(): " .. tostring(e) end;
-	local dll, e;
-	if lib == "" then lib = dl.NULL end;
-	dll, e = dlopen(lib, 2);
-	if not dll then return nil, "lib opening: " .. tostring(e) end;
-	if dll == dl.NULL then
-		e = dl.dlffi_Pointer(dlerror()):tostring();
-		return nil, "lib opening failed: " .. tostring(e);
-	end;
+	local dll, e = dl.dlopen(lib);
+	if not dll then return nil, "lib opening failed: " .. tostring(e) end;
 	local sym;
-	sym, e = dlsym(dll, name);
+	sym, e = dll:sym(name);
 	if not sym then return nil, "symbol loading: " .. tostring(e) end;
 	if sym == dl.NULL then return nil, "symbol loading failed" end;
-	dlclose(dll);
 	local o = {};
 	o.symbol = sym;
+	-- keep the library loaded while the symbol is in use
+	o.lib = dll;
 	local struct;
 	struct, e = Dlffi_t:new("main", { ffitype });
 	if not struct then return nil, "Dlffi_t:new(): " .. tostring(e) end;
@@ -254,9 +119,68 @@ local function is_callable(obj)
 end;
 -- }}} is_callable()
 
+-- {{{ class_mt(self, api, spec) -- metatable shared by the objects
+--	objects with the same API tables and specials share a metatable,
+--	which keeps constructor wrappers; methods are looked up raw in the
+--	API tables on every access, so later assignments to them are seen
+local classes = setmetatable({}, {__mode = "k"});
+local nospec = {};
+local specs = {}; -- key of the metatables by specials in the tree
+local function class_mt(self, api, spec)
+	-- walk the tree of API tables, then pick by specials
+	local node = classes;
+	for i = 1, #api, 1 do
+		local next = node[api[i]];
+		if not next then
+			next = setmetatable({}, {__mode = "k"});
+			node[api[i]] = next;
+		end;
+		node = next;
+	end;
+	local byspec = node[specs];
+	if not byspec then
+		byspec = setmetatable({}, {__mode = "k"});
+		node[specs] = byspec;
+	end;
+	local mt = byspec[spec];
+	if mt then return mt end;
+	-- { function, wrapper } by the name of a constructor
+	local wrappers = {};
+	mt = { __index = function (t, v)
+		local f;
+		-- find table with the requested key
+		for i = 1, #api, 1 do
+			f = rawget(api[i], v);
+			if f ~= nil then break end;
+		end;
+		local constructor = spec[v]; -- if a constructor requested
+		if not constructor then return f end;
+		-- the wrapper is reused while it wraps the same function
+		local w = wrappers[v];
+		if w and (w[1] == f) then return w[2] end;
+		-- get it's GC
+		local gc = is_callable(constructor) and constructor or nil;
+		-- construct appropriate proxy function
+		local m = function(obj, ...)
+			return self:new(
+				api,
+				f(obj, ...),
+				gc,
+				spec
+			);
+		end;
+		wrappers[v] = { f, m };
+		return m;
+	end };
+	byspec[spec] = mt;
+	return mt;
+end;
+-- }}} class_mt()
+
 function Dlffi:new(api, init, gc, spec)
 	--[[
-		api	- table of tables with API
+		api	- table of tables with API, searched in order
+			  with rawget()
 		init	- userdata or anything
 		gc	- destructor: void function(self)
 		spec	- list of special functions
@@ -270,7 +194,7 @@ function Dlffi:new(api, init, gc, spec)
 	if init == nil or init == dl.NULL then
 		return nil, "Bad initial value specified";
 	end;
-	if not spec then spec = {} end;
+	if not spec then spec = nospec end;
 	if gc ~= nil then
 		if not is_callable(gc) then
 			return nil, "GC must be a function";
@@ -281,27 +205,7 @@ function Dlffi:new(api, init, gc, spec)
 			if (val ~= nil) and (val ~= dl.NULL) then gc(val) end;
 		end;
 	end;
-	setmetatable(o, { __index = function (t, v)
-		local f;
-		-- find table with the requested key
-		for i = 1, #api, 1 do
-			f = rawget(api[i], v);
-			if f ~= nil then break end;
-		end;
-		local constructor = spec[v]; -- if a constructor requested
-		if not constructor then return f end;
-		-- get it's GC
-		local gc = is_callable(constructor) and constructor or nil;
-		-- construct appropriate proxy function
-		return function(obj, ...)
-			return self:new(
-				api,
-				f(obj, ...),
-				gc,
-				spec
-			);
-		end;
-	end });
+	setmetatable(o, class_mt(self, api, spec));
 	return o;
 end;
 -- }}} Dlffi
@@ -373,6 +277,9 @@ function Dlffi_t:new(k, v)
 	rawset(o, "new", self.malloc);
 	rawset(o, "get", self.get);
 	rawset(o, "put", self.put);
+	rawset(o, "view", self.view);
+	rawset(o, "decode", self.decode);
+	rawset(o, "encode", self.encode);
 	return o;
 end;
 -- }}} Dlffi_t:new()
@@ -404,6 +311,55 @@ function Dlffi_t:put(name, obj, num, val)
 end;
 -- }}} Dlffi_t:put()
 
+-- {{{ Dlffi_t:view() - access structure elements by names
+function Dlffi_t:view(name, obj)
+	if type(obj) == "table" then
+		return self:view(name, cast_table(self.view, obj));
+	end;
+	if type(name) == "string" then name = self[name] end;
+	return dl.type_view(obj, name);
+end;
+-- }}} Dlffi_t:view()
+
+-- {{{ Dlffi_t:decode() - read an array of structures into Lua tables
+--	name	- structure type or its name
+--	obj	- pointer to the first structure
+--	num	- number of structures
+--	columnar - return a table of columns instead of a table of rows
+function Dlffi_t:decode(name, obj, num, columnar)
+	if type(obj) == "table" then
+		return self:decode(name, cast_table(self.decode, obj), num,
+			columnar);
+	end;
+	if type(name) == "string" then name = self[name] end;
+	return dl.type_decode(obj, name, num, columnar);
+end;
+-- }}} Dlffi_t:decode()
+
+-- {{{ Dlffi_t:encode() - pack Lua tables into a new array of structures
+--	name	- structure type or its name
+--	rows	- table as returned by Dlffi_t:decode()
+--	columnar - rows is a table of columns
+--	Return: buffer, which also owns the string copies, number of structures
+function Dlffi_t:encode(name, rows, columnar)
+	if type(name) == "string" then name = self[name] end;
+	local num = 0;
+	if columnar then
+		for _, v in pairs(rows) do
+			if (type(v) == "table") and (#v > num) then num = #v end;
+		end;
+	else
+		num = #rows;
+	end;
+	-- keep at least one byte for malloc()
+	local buf = dl.dlffi_Pointer(math.max(num * dl.sizeof(name), 1), true);
+	if not buf then return nil, "malloc() failed" end;
+	local r, e = dl.type_encode(buf, name, rows, columnar, dl.arena());
+	if not r then return nil, e end;
+	return buf, r;
+end;
+-- }}} Dlffi_t:encode()
+
 -- }}} Dlffi_t
 
 -- {{{ Header
@@ -546,26 +502,43 @@ end;
 Header.normalize = normalize;
 -- }}} Header.normalize()
 
--- {{{ Header.put_symbol(...) - place symbol to the library table
---	symbol	- loaded symbol (any reference)
+-- {{{ Header.symbol_places(...) - tables and keys the symbol is placed to
 --	lib	- library table
 --	opt	- normalized header options
 --	name	- shortest name of the function
-local put_symbol = function(symbol, lib, opt, name)
+local symbol_places = function(lib, opt, name)
+	local places = {};
 	local left = {};
 	for i = 1, #(opt["hierarchy"]), 1 do left[i] = opt["hierarchy"][i] end;
 	repeat
-		-- place symbol to the current hierarchy level
+		-- the current hierarchy level
 		local tbl = table.concat(left, opt["glue"]);
 		if not lib[tbl] then lib[tbl] = {} end;
-		tbl = lib[tbl];
-		tbl[name] = symbol;
+		table.insert(places, { lib[tbl], name });
 		-- decrease hierarchy level
 		tbl = left[#left];
 		if not tbl then break end;
 		table.remove(left);
 		name = tbl .. (opt["glue"]) .. name;
 	until #(opt["hierarchy"]) < 1;
+	return places;
+end;
+Header.symbol_places = function(lib, opt, name)
+	return symbol_places(lib, normalize(opt), name);
+end;
+-- }}} Header.symbol_places()
+
+-- {{{ Header.put_symbol(...) - place symbol to the library table
+--	symbol	- loaded symbol (any reference)
+--	lib	- library table
+--	opt	- normalized header options
+--	name	- shortest name of the function
+local put_symbol = function(symbol, lib, opt, name)
+	local places = symbol_places(lib, opt, name);
+	for i = 1, #places, 1 do
+		local place = places[i];
+		place[1][place[2]] = symbol;
+	end;
 end;
 -- export it with normalization included
 Header.put_symbol = function(symbol, lib, opt, name)
@@ -595,46 +568,148 @@ end;
 Header.find_header = find_header;
 -- }}} Header.find_header()
 
+-- {{{ Header.bind_symbol(...) - load symbol from the first library having it
+--	libs	- list of library names
+--	proto	- function prototype (table from header)
+--	opt	- normalized header options
+local bind_symbol = function(libs, proto, opt)
+	-- load symbol with it's original name
+	local name = proto[1];
+	if #(opt["prefix"]) > 0 then
+		name = (opt["prefix"]) .. (opt["glue"]) .. name;
+	end;
+	-- probe all given libraries
+	for i = 1, #libs, 1 do
+		local f = dl.load(libs[i], name, table.unpack(proto, 2));
+		if f then return f end;
+	end;
+	return nil, "Invalid prototype or symbol not found: " .. name;
+end;
+Header.bind_symbol = bind_symbol;
+-- }}} Header.bind_symbol()
+
+-- {{{ lazy binding state of library tables
+--	bound	- number of symbols bound so far
+--	total	- number of symbols declared
+--	pending	- [table][key] = binder of the symbol
+local lazy_states = setmetatable({}, { __mode = "k" });
+
+-- {{{ lazy_state(...) - lazy binding state of the library table
+--	lib	- library table
+--	handles	- shared handlers of the probed libraries
+local lazy_state = function(lib, handles)
+	local state = lazy_states[lib];
+	if not state then
+		state = {
+			bound = 0,
+			total = 0,
+			pending = setmetatable({}, { __mode = "k" }),
+			handles = {},
+		};
+		-- resolve the symbol on the first access
+		state.mt = { __index = function(t, k)
+			local p = state.pending[t];
+			local bind = p and p[k];
+			if bind then return bind() end;
+		end };
+		lazy_states[lib] = state;
+	end;
+	for i = 1, #handles, 1 do table.insert(state.handles, handles[i]) end;
+	return state;
+end;
+-- }}} lazy_state()
+
+-- {{{ lazy_symbol(...) - install a binder of the symbol
+--	state	- lazy binding state of the library table
+--	libs	- list of library names
+--	proto	- function prototype (table from header)
+--	lib	- library table
+--	opt	- normalized header options
+local lazy_symbol = function(state, libs, proto, lib, opt)
+	local places = symbol_places(lib, opt, proto[1]);
+	local f;
+	local bind = function()
+		if f then return f end;
+		local e;
+		f, e = bind_symbol(libs, proto, opt);
+		if not f then error(e, 2) end;
+		f = proxify(f, proto, lib, opt);
+		-- replace the binder in every table
+		for i = 1, #places, 1 do
+			local tbl, key = places[i][1], places[i][2];
+			state.pending[tbl][key] = nil;
+			rawset(tbl, key, f);
+		end;
+		state.bound = state.bound + 1;
+		return f;
+	end;
+	local eager = false;
+	for i = 1, #places, 1 do
+		local tbl, key = places[i][1], places[i][2];
+		local mt = getmetatable(tbl);
+		if not mt then
+			setmetatable(tbl, state.mt);
+		elseif mt ~= state.mt then
+			-- the table is not ours to hook
+			eager = true;
+		end;
+		if not state.pending[tbl] then state.pending[tbl] = {} end;
+		state.pending[tbl][key] = bind;
+		rawset(tbl, key, nil);
+	end;
+	state.total = state.total + 1;
+	if eager then
+		local r, e = pcall(bind);
+		if not r then return nil, e end;
+	end;
+	return true;
+end;
+-- }}} lazy_symbol()
+
+-- {{{ Header.lazy_stats(...) - counters of lazy binding
+--	lib	- library table
+--	Return: number of bound symbols, number of declared symbols
+Header.lazy_stats = function(lib)
+	local state = lazy_states[lib];
+	if not state then return 0, 0 end;
+	return state.bound, state.total;
+end;
+-- }}} Header.lazy_stats()
+-- }}} lazy binding state of library tables
+
 -- {{{ Header.loadlib(...)
 --	header	- header table
 --	lib	- target library table (may be nil)
-local loadlib = function (header, lib)
+--	lazy	- bind symbols on the first access (may be set in metadata)
+local loadlib = function (header, lib, lazy)
 	if not lib then lib = {} end;
 	local meta = header["_dlffi"];
 	if not meta then return nil, "No header metadata found" end;
+	if lazy == nil then lazy = meta["lazy"] end;
 	local libs = meta["lib"];
 	if type(libs) == "string" then libs = { libs } end;
+	-- hold the shared handlers while probing, so failed probes
+	-- do not reopen the libraries
+	local handles = {};
+	for i = 1, #libs, 1 do handles[i] = dl.dlopen(libs[i]) end;
+	local state;
+	if lazy then state = lazy_state(lib, handles) end;
 	for i = 1, #header, 1 do
 		local cur = header[i];
 		local opt = normalize(cur["_dlffi"]);
 		for j = 1, #cur, 1 do
 			local v = cur[j];
-			-- load symbol with it's original name
-			local name = v[1];
-			if #(opt["prefix"]) > 0 then
-				v[1] = (opt["prefix"]) ..
-					(opt["glue"]) .. v[1];
+			if lazy then
+				local r, e = lazy_symbol(state, libs, v, lib, opt);
+				if not r then return nil, e end;
 			else
-				v[1] = (opt["prefix"]) .. v[1];
-			end;
-			local f;
-			-- probe all given libraries
-			for i = 1, #libs, 1 do
-				f = dl.load(libs[i], table.unpack(v));
-				if f then break end;
-			end;
-			if not f then
-				return nil,
-					"Invalid prototype " ..
-					"or symbol not found: " ..
-					tostring(v[1]);
+				local f, e = bind_symbol(libs, v, opt);
+				if not f then return nil, e end;
+				-- make proxy function if needed
+				f = proxify(f, v, lib, opt);
+				-- place symbol in tables according to hierarchy
+				put_symbol(f, lib, opt, v[1]);
 			end;
-			-- name of function was previously modified, restore it back
-			v[1] = name;
-			-- make proxy function if needed
-			f = proxify(f, v, lib, opt);
-			-- place symbol in tables according to given hierarchy
-			put_symbol(f, lib, opt, name);
 		end;
 	end;
 	return lib;
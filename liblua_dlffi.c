@@ -1,5 +1,6 @@
 #define _GNU_SOURCE
 #include <features.h>
+#include <stdarg.h>
 #include <string.h>
 #include <lua.h>
 #include <lauxlib.h>
@@ -9,23 +10,194 @@
 #include <ffi.h>
 #include <endian.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
 
 /* {{{ struct dlffi_Pointer */
 typedef struct dlffi_Pointer {
 	void *pointer;
+	// 1 - free() the memory, DLFFI_GC_MUNMAP - see dlffi_Mmap
 	int gc;
 	int ref;
+	// bytes known to be at the pointer, 0 if unknown
+	size_t size;
 } dlffi_Pointer;
 /* }}} struct dlffi_Pointer */
 
+/* {{{ struct dlffi_Mmap */
+#define DLFFI_GC_MUNMAP 2
+// dlffi_Pointer to a memory mapped file, made by dl.mmap()
+typedef struct dlffi_Mmap {
+	dlffi_Pointer p;
+	// the mapping as returned by mmap(), page aligned
+	void *base;
+	size_t size;
+	// bytes available from the pointer
+	size_t len;
+	// changes are written to the file
+	int shared;
+	// protection of the pages, writes to PROT_READ ones are refused
+	int prot;
+	// pending async() calls taking the mapping, see value_mapping()
+	int busy;
+} dlffi_Mmap;
+/* }}} struct dlffi_Mmap */
+
+/* {{{ struct dlffi_Scratch */
+// storage for string arguments copied during a call
+typedef struct dlffi_Scratch {
+	// free space of the preallocated buffer
+	char *buf;
+	size_t left;
+	// malloc'ed strings which did not fit the buffer
+	void *spill;
+	// the arguments stay on the stack until the call returns,
+	// so strings of ffi_type_cstring may be passed without copies
+	int borrow;
+	// owner of the copies instead of the spill list, see dlffi_Arena
+	struct dlffi_Arena *arena;
+} dlffi_Scratch;
+/* }}} struct dlffi_Scratch */
+
+/* {{{ ffi_type dlffi_type_cstring */
+// (const char *) argument, Lua strings are borrowed instead of copied
+static ffi_type dlffi_type_cstring = {
+	sizeof(void *), __alignof__(void *), FFI_TYPE_POINTER, NULL
+};
+/* }}} dlffi_type_cstring */
+
+/* {{{ struct dlffi_String */
+// bytes of foreign memory, see string_base()
+typedef struct dlffi_String {
+	const char *pointer;
+	size_t len;
+	// the viewed dlffi_Pointer, which may be reallocated, or NULL
+	dlffi_Pointer *owner;
+	size_t offset;
+} dlffi_String;
+/* }}} struct dlffi_String */
+
+/* {{{ struct dlffi_Struct */
+// structure in memory accessed by element names
+typedef struct dlffi_Struct {
+	void *pointer;
+	// the viewed dlffi_Pointer, which may be reallocated, or NULL
+	dlffi_Pointer *owner;
+	ffi_type *type;
+} dlffi_Struct;
+/* }}} struct dlffi_Struct */
+
+/* {{{ struct dlffi_Op */
+struct dlffi_Function;
+// push C value as a Lua value, no stack check is performed
+typedef int (*dlffi_Push)(lua_State *L, void *o);
+// write Lua value at the index as C value, see type_write()
+typedef void *(*dlffi_Write)(
+	lua_State *L,
+	int idx,
+	ffi_type *type,
+	void *dst,
+	struct dlffi_Function *func,
+	dlffi_Scratch *scratch
+);
+// converters of a single value chosen once by its FFI type
+typedef struct dlffi_Op {
+	ffi_type *type;
+	dlffi_Push push;
+	dlffi_Write write;
+	// offset of the output buffer within the call frame, 0 for inputs
+	size_t out;
+} dlffi_Op;
+/* }}} struct dlffi_Op */
+
+/* {{{ struct dlffi_View */
+// array of C values in memory copied to and from Lua in bulk
+typedef struct dlffi_View {
+	char *pointer;
+	// the viewed dlffi_Pointer, which may be reallocated, or NULL
+	dlffi_Pointer *owner;
+	ffi_type *type;
+	size_t n;
+	dlffi_Push push;
+	dlffi_Write write;
+} dlffi_View;
+/* }}} struct dlffi_View */
+
+/* {{{ struct dlffi_Library */
+// resolved dynamic symbol
+typedef struct dlffi_Symbol {
+	char *name;
+	void *address;
+	struct dlffi_Symbol *next;
+} dlffi_Symbol;
+
+// dynamic library handler shared by all the objects using the library
+typedef struct dlffi_Library {
+	// path given to dlopen(), "" for the main program
+	char *path;
+	void *dlhdl;
+	// number of objects holding the handler
+	size_t refs;
+	// hash table of resolved symbols
+	dlffi_Symbol **symbols;
+	size_t nbuckets;
+	size_t nsymbols;
+	struct dlffi_Library *next;
+} dlffi_Library;
+/* }}} struct dlffi_Library */
+
+/* {{{ closure modes */
+enum {
+	// run on the captured Lua state in any thread
+	DLFFI_CLOSURE_DIRECT = 0,
+	// queue the call and wait for dl.poll() to run it
+	DLFFI_CLOSURE_QUEUE,
+	// queue the call and return zeroed value immediately
+	DLFFI_CLOSURE_POST
+};
+/* }}} closure modes */
+
+/* {{{ struct dlffi_Varcif */
+// call interface of a variadic function prepared for a shape of arguments
+typedef struct dlffi_Varcif {
+	ffi_cif cif;
+	// types of the fixed and the variadic arguments, NULL if unused
+	ffi_type **types;
+	size_t argc;
+	// converters of the arguments
+	dlffi_Op *plan;
+	// preallocated call frame
+	void **argv;
+	size_t frame_size;
+	// number of running calls, such an entry is never evicted
+	int busy;
+	// tick of the last use for the eviction
+	unsigned long used;
+} dlffi_Varcif;
+// number of argument shapes cached per variadic function
+#define DLFFI_VARCIF 8
+/* }}} struct dlffi_Varcif */
+
 /* {{{ struct dlffi_Function */
 typedef struct dlffi_Function {
-	// dynamic library handler
-	void *dlhdl;
+	// shared dynamic library handler
+	dlffi_Library *lib;
 	// dynamic symbol handler
 	void *dlsym;
-	// FFI function context
-	ffi_cif cif;
+	// FFI function context, shared one if the signature is interned
+	ffi_cif *cif;
+	// interned signature, which owns the cif, the types and the plan
+	struct dlffi_Sig *sig;
+	// native call stub of the signature, if any
+	void (*stub)(void *fn, void **argv, void *ret);
 	// FFI arguments types for the function
 	ffi_type **types;
 	// FFI type of the function's return value
@@ -40,6 +212,42 @@ typedef struct dlffi_Function {
 	lua_State *L;
 	// reference to Lua function to cast tables to C type
 	int ref_table;
+	// or name of the table field with the value, referenced by ref_table
+	const char *cast_field;
+	// number of arguments
+	size_t argc;
+	// preallocated call frame: argument pointers followed by values
+	void **argv;
+	// size of the call frame
+	size_t frame_size;
+	// preallocated buffer for string arguments
+	char *strbuf;
+	size_t strbuf_size;
+	// the preallocated frame is in use by a running call
+	int busy;
+	// marshaling plan: converters of arguments and the return value
+	dlffi_Op *plan;
+	// closure mode for the calls from foreign threads
+	int mode;
+	// thread, where the Lua state is running
+	pthread_t owner;
+	// queue of the calls from foreign threads, see queue_release()
+	struct dlffi_Queue *queue;
+	// posted calls not run yet, the closure is pinned by pin meanwhile
+	atomic_int posted;
+	int pin;
+	// name of the dynamic symbol, owned by the library, or NULL
+	const char *name;
+	// call statistics, allocated once enabled by dl.stats(true)
+	struct dlffi_Stats *stats;
+	// indices of output arguments in the order of returned values
+	size_t *outs;
+	size_t nouts;
+	// argc fixed arguments are followed by variadic ones
+	int variadic;
+	// recently used shapes of variadic arguments, allocated on demand
+	dlffi_Varcif *varcifs;
+	unsigned long varuse;
 } dlffi_Function;
 /* }}} dlffi_Function */
 
@@ -51,64 +259,157 @@ dlffi_Pointer *dlffi_check_Pointer(lua_State *L, int idx) {
 }
 /* }}} dlffi_check_Pointer */
 
+/* {{{ const char *string_base(dlffi_String *o) */
+//	views of a dlffi_Pointer read its address on every access, as
+//	realloc() moves and munmap() releases the memory
+//	Return: NULL if the memory is released
+static const char *string_base(dlffi_String *o)
+{
+	if (o->owner == NULL) return o->pointer;
+	if (o->owner->pointer == NULL) return NULL;
+	return (const char *)o->owner->pointer + o->offset;
+}
+/* }}} string_base */
+
+/* {{{ void *struct_base(dlffi_Struct *o) */
+static void *struct_base(dlffi_Struct *o)
+{
+	return o->owner ? o->owner->pointer : o->pointer;
+}
+/* }}} struct_base */
+
+/* {{{ int pointer_readonly(dlffi_Pointer *p) */
+//	Return: 1 if the pointer is a read-only mapping of a file
+static int pointer_readonly(dlffi_Pointer *p)
+{
+	return p && (p->gc == DLFFI_GC_MUNMAP) &&
+		!(((dlffi_Mmap *)p)->prot & PROT_WRITE);
+}
+/* }}} pointer_readonly */
+
+/* {{{ dlffi_Mmap *value_mapping(lua_State *L, int idx) */
+//	Return: mapping of a file the dlffi_Pointer, dlffi_Struct or
+//	dlffi_String at idx points into, or NULL
+static dlffi_Mmap *value_mapping(lua_State *L, int idx)
+{
+	dlffi_Pointer *p = NULL;
+	void *u;
+	if ((u = luaL_testudata(L, idx, "dlffi_Pointer"))) p = u;
+	else if ((u = luaL_testudata(L, idx, "dlffi_Struct")))
+		p = ((dlffi_Struct *)u)->owner;
+	else if ((u = luaL_testudata(L, idx, "dlffi_String")))
+		p = ((dlffi_String *)u)->owner;
+	return (p && (p->gc == DLFFI_GC_MUNMAP)) ? (dlffi_Mmap *)p : NULL;
+}
+/* }}} value_mapping */
+
+/* {{{ void pointer_pin(lua_State *L, int idx, int val) */
+//	keep the value alive while the dlffi_Pointer at idx is, in a set
+//	stored as the uservalue of the pointer
+static void pointer_pin(lua_State *L, int idx, int val)
+{
+	idx = lua_absindex(L, idx);
+	val = lua_absindex(L, val);
+	if (lua_checkstack(L, 3) == 0) return;
+	if (lua_getuservalue(L, idx) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_setuservalue(L, idx);
+	}
+	lua_pushvalue(L, val);
+	lua_pushboolean(L, 1);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+}
+/* }}} pointer_pin */
+
+/* {{{ pushers of C values */
+#define DLFFI_PUSH(name, push, ctype) \
+static int push_##name(lua_State *L, void *o) \
+{ \
+	push(L, *(ctype *)o); \
+	return 1; \
+}
+DLFFI_PUSH(pointer, lua_pushlightuserdata, void *)
+DLFFI_PUSH(float, lua_pushnumber, float)
+DLFFI_PUSH(double, lua_pushnumber, double)
+DLFFI_PUSH(longdouble, lua_pushnumber, long double)
+DLFFI_PUSH(ulong, lua_pushinteger, unsigned long)
+DLFFI_PUSH(slong, lua_pushinteger, signed long)
+DLFFI_PUSH(uint, lua_pushinteger, unsigned int)
+DLFFI_PUSH(sint, lua_pushinteger, signed int)
+DLFFI_PUSH(uchar, lua_pushinteger, unsigned char)
+DLFFI_PUSH(schar, lua_pushinteger, signed char)
+DLFFI_PUSH(ushort, lua_pushinteger, unsigned short)
+DLFFI_PUSH(sshort, lua_pushinteger, signed short)
+DLFFI_PUSH(uint64, lua_pushinteger, u_int64_t)
+DLFFI_PUSH(sint64, lua_pushinteger, int64_t)
+DLFFI_PUSH(uint32, lua_pushinteger, u_int32_t)
+DLFFI_PUSH(sint32, lua_pushinteger, int32_t)
+DLFFI_PUSH(uint16, lua_pushinteger, u_int16_t)
+DLFFI_PUSH(sint16, lua_pushinteger, int16_t)
+DLFFI_PUSH(uint8, lua_pushinteger, u_int8_t)
+DLFFI_PUSH(sint8, lua_pushinteger, int8_t)
+#undef DLFFI_PUSH
+
+static int push_void(lua_State *L, void *o)
+{
+	(void)o;
+	lua_pushnil(L);
+	return 1;
+}
+
+// unknown structure, create dlffi_Pointer
+static int push_struct(lua_State *L, void *o)
+{
+	dlffi_Pointer *p = (dlffi_Pointer *)
+		lua_newuserdata(L, sizeof(dlffi_Pointer));
+	if (!p) return 0;
+	p->pointer = o;
+	p->gc = 0;
+	p->ref = LUA_REFNIL;
+	p->size = 0;
+	luaL_getmetatable(L, "dlffi_Pointer");
+	lua_setmetatable(L, -2);
+	return 1;
+}
+/* }}} pushers of C values */
+
+/* {{{ dlffi_Push type_pusher(ffi_type *t) */
+dlffi_Push type_pusher(ffi_type *t)
+{
+	if (t == &ffi_type_pointer) return push_pointer;
+	if (t == &dlffi_type_cstring) return push_pointer;
+	if (t == &ffi_type_void) return push_void;
+	if (t == &ffi_type_float) return push_float;
+	if (t == &ffi_type_double) return push_double;
+	if (t == &ffi_type_longdouble) return push_longdouble;
+	if (t == &ffi_type_ulong) return push_ulong;
+	if (t == &ffi_type_slong) return push_slong;
+	if (t == &ffi_type_uint) return push_uint;
+	if (t == &ffi_type_sint) return push_sint;
+	if (t == &ffi_type_uchar) return push_uchar;
+	if (t == &ffi_type_schar) return push_schar;
+	if (t == &ffi_type_ushort) return push_ushort;
+	if (t == &ffi_type_sshort) return push_sshort;
+	if (t == &ffi_type_uint64) return push_uint64;
+	if (t == &ffi_type_sint64) return push_sint64;
+	if (t == &ffi_type_uint32) return push_uint32;
+	if (t == &ffi_type_sint32) return push_sint32;
+	if (t == &ffi_type_uint16) return push_uint16;
+	if (t == &ffi_type_sint16) return push_sint16;
+	if (t == &ffi_type_uint8) return push_uint8;
+	if (t == &ffi_type_sint8) return push_sint8;
+	return push_struct;
+}
+/* }}} type_pusher */
+
 /* {{{ int type_push(lua_State *L, void *o, ffi_type *t) */
 int type_push(lua_State *L, void *o, ffi_type *t)
 {
 	if (lua_checkstack(L, 1) == 0) return 0;
-	if (t == &ffi_type_pointer) {
-		lua_pushlightuserdata(L, *(void **)o);
-	} else if (t == &ffi_type_void) {
-		lua_pushnil(L);
-	} else if (t == &ffi_type_float) {
-		lua_pushnumber(L, *(float *)o);
-	} else if (t == &ffi_type_double) {
-		lua_pushnumber(L, *(double *)o);
-	} else if (t == &ffi_type_longdouble) {
-		lua_pushnumber(L, *(long double *)o);
-	} else if (t == &ffi_type_ulong) {
-		lua_pushinteger(L, *(unsigned long *)o);
-	} else if (t == &ffi_type_slong) {
-		lua_pushinteger(L, *(signed long *)o);
-	} else if (t == &ffi_type_uint) {
-		lua_pushinteger(L, *(unsigned int *)o);
-	} else if (t == &ffi_type_sint) {
-		lua_pushinteger(L, *(signed int *)o);
-	} else if (t == &ffi_type_uchar) {
-		lua_pushinteger(L, *(unsigned char *)o);
-	} else if (t == &ffi_type_schar) {
-		lua_pushinteger(L, *(signed char *)o);
-	} else if (t == &ffi_type_ushort) {
-		lua_pushinteger(L, *(unsigned short *)o);
-	} else if (t == &ffi_type_sshort) {
-		lua_pushinteger(L, *(signed short *)o);
-	} else if (t == &ffi_type_uint64) {
-		lua_pushinteger(L, *(u_int64_t *)o);
-	} else if (t == &ffi_type_sint64) {
-		lua_pushinteger(L, *(int64_t *)o);
-	} else if (t == &ffi_type_uint32) {
-		lua_pushinteger(L, *(u_int32_t *)o);
-	} else if (t == &ffi_type_sint32) {
-		lua_pushinteger(L, *(int32_t *)o);
-	} else if (t == &ffi_type_uint16) {
-		lua_pushinteger(L, *(u_int16_t *)o);
-	} else if (t == &ffi_type_sint16) {
-		lua_pushinteger(L, *(int16_t *)o);
-	} else if (t == &ffi_type_uint8) {
-		lua_pushinteger(L, *(u_int8_t *)o);
-	} else if (t == &ffi_type_sint8) {
-		lua_pushinteger(L, *(int8_t *)o);
-	} else {
-		// unknown structure, create dlffi_Pointer
-		dlffi_Pointer *p = (dlffi_Pointer *)
-			lua_newuserdata(L, sizeof(dlffi_Pointer));
-		if (!p) return 0;
-		p->pointer = o;
-		p->gc = 0;
-		p->ref = LUA_REFNIL;
-		luaL_getmetatable(L, "dlffi_Pointer");
-		lua_setmetatable(L, -2);
-	}
-	return 1;
+	return type_pusher(t)(L, o);
 }
 /* }}} type_push */
 
@@ -129,19 +430,54 @@ void write_value(
 }
 // }}} write_value
 
+static void *arena_alloc(struct dlffi_Arena *a, size_t size, size_t align);
+
+/* {{{ void *scratch_alloc(dlffi_Scratch *s, size_t size) */
+//	without scratch storage the buffer is malloc'ed and never freed
+void *scratch_alloc(dlffi_Scratch *s, size_t size)
+{
+	if (s == NULL) return malloc(size);
+	if (s->arena) return arena_alloc(s->arena, size, 1);
+	if (size <= s->left) {
+		void *p = s->buf;
+		s->buf += size;
+		s->left -= size;
+		return p;
+	}
+	void **spill = malloc(sizeof(void *) + size);
+	if (!spill) return NULL;
+	*spill = s->spill;
+	s->spill = spill;
+	return spill + 1;
+}
+/* }}} scratch_alloc */
+
+/* {{{ void scratch_free(dlffi_Scratch *s) */
+void scratch_free(dlffi_Scratch *s)
+{
+	while (s->spill) {
+		void **spill = s->spill;
+		s->spill = *spill;
+		free(spill);
+	}
+}
+/* }}} scratch_free */
+
 /* {{{ type_write(...) */
 //	L	- Lua thread
 //	idx	- index of the value in the Lua stack
 //	type	- expected FFI type of the value
 //	dst	- allocated buffer for the value
 //	func	- dlffi_Function of which aruments are being parsed, if any
+//	scratch	- storage for copies of strings, if any
 //	Return: NULL on error or some invalid pointer on success
 void *type_write(
 	lua_State *L,
 	int idx,
 	ffi_type *type,
 	void *dst,
-	dlffi_Function *func
+	dlffi_Function *func,
+	dlffi_Scratch *scratch
 )
 {
 	void *u = NULL;
@@ -182,8 +518,18 @@ void *type_write(
 				val_u = ((dlffi_Function *)val_u)->dlsym;
 			}
 			} else {
-			// dlffi_Pointer
-			val_u = (dlffi_check_Pointer(L, idx))->pointer;
+			// dlffi_Pointer, dlffi_Struct or dlffi_String
+			void *p;
+			if ((p = luaL_testudata(L, idx, "dlffi_Pointer")))
+				val_u = ((dlffi_Pointer *)p)->pointer;
+			else if ((p = luaL_testudata(L, idx, "dlffi_Struct")))
+				val_u = struct_base(p);
+			else if ((p = luaL_testudata(L, idx, "dlffi_String")))
+				val_u = (void *)string_base(p);
+			else {
+				lua_pop(L, 2);
+				return NULL;
+			}
 			}
 			lua_pop(L, 2);
 		} else {
@@ -213,7 +559,7 @@ void *type_write(
 		if (type != &ffi_type_pointer) return NULL;
 		size_t l;
 		char *c = (char *)lua_tolstring(L, idx, &l);
-		val_u = malloc(l + 1);
+		val_u = scratch_alloc(scratch, l + 1);
 		if (!val_u) return NULL;
 		memcpy(val_u, c, l + 1);
 		len = sizeof(void *);
@@ -221,16 +567,28 @@ void *type_write(
 		break;
 	case LUA_TTABLE:
 		if (func == NULL) return NULL;
-		if (func->ref_table == LUA_REFNIL) return NULL;
 		if ( lua_checkstack(L, 3) == 0 ) return NULL;
 		// save stack to avoid any modifications
 		int top = lua_gettop(L);
+		if (func->cast_field) {
+			// the value is kept in the field, nil and NULL refused
+			lua_pushstring(L, func->cast_field);
+			lua_rawget(L, idx);
+			if ( (! lua_toboolean(L, -1)) || (
+				(lua_type(L, -1) == LUA_TLIGHTUSERDATA) &&
+				(lua_touserdata(L, -1) == NULL)
+			) ) u = NULL;
+			else u = type_write(L, top + 1, type, dst, func, scratch);
+			lua_settop(L, top);
+			return u;
+		}
+		if (func->ref_table == LUA_REFNIL) return NULL;
 		// call the referent function
 		lua_rawgeti(L, LUA_REGISTRYINDEX, func->ref_table);
 		lua_pushlightuserdata(L, func);
 		lua_pushvalue(L, idx);
 		if ( lua_pcall(L, 2, 1, 0) == 0 ) {
-			u = type_write(L, top + 1, type, dst, func);
+			u = type_write(L, top + 1, type, dst, func, scratch);
 		} else u = NULL;
 		// restore stack
 		lua_settop(L, top);
@@ -243,41 +601,260 @@ void *type_write(
 }
 /* }}} type_write */
 
-/* {{{ ffi_type *dlffi_type_init(int size) */
-/* initialize a new type of function return value, specified by a size */
+/* {{{ writers of Lua values */
+#define DLFFI_WRITE_INT(name, ctype) \
+static void *write_##name( \
+	lua_State *L, \
+	int idx, \
+	ffi_type *type, \
+	void *dst, \
+	dlffi_Function *func, \
+	dlffi_Scratch *scratch \
+) { \
+	switch (lua_type(L, idx)) { \
+	case LUA_TNUMBER: \
+		*(ctype *)dst = (ctype)lua_tointeger(L, idx); \
+		return dst; \
+	case LUA_TBOOLEAN: \
+		*(ctype *)dst = (ctype)lua_toboolean(L, idx); \
+		return dst; \
+	default: \
+		return type_write(L, idx, type, dst, func, scratch); \
+	} \
+}
+DLFFI_WRITE_INT(uint64, u_int64_t)
+DLFFI_WRITE_INT(sint64, int64_t)
+DLFFI_WRITE_INT(uint32, u_int32_t)
+DLFFI_WRITE_INT(sint32, int32_t)
+DLFFI_WRITE_INT(uint16, u_int16_t)
+DLFFI_WRITE_INT(sint16, int16_t)
+DLFFI_WRITE_INT(uint8, u_int8_t)
+DLFFI_WRITE_INT(sint8, int8_t)
+#undef DLFFI_WRITE_INT
+
+#define DLFFI_WRITE_FLOAT(name, ctype) \
+static void *write_##name( \
+	lua_State *L, \
+	int idx, \
+	ffi_type *type, \
+	void *dst, \
+	dlffi_Function *func, \
+	dlffi_Scratch *scratch \
+) { \
+	if (lua_type(L, idx) == LUA_TNUMBER) { \
+		*(ctype *)dst = (ctype)lua_tonumber(L, idx); \
+		return dst; \
+	} \
+	return type_write(L, idx, type, dst, func, scratch); \
+}
+DLFFI_WRITE_FLOAT(float, float)
+DLFFI_WRITE_FLOAT(double, double)
+DLFFI_WRITE_FLOAT(longdouble, long double)
+#undef DLFFI_WRITE_FLOAT
+
+static void *write_pointer(
+	lua_State *L,
+	int idx,
+	ffi_type *type,
+	void *dst,
+	dlffi_Function *func,
+	dlffi_Scratch *scratch
+) {
+	dlffi_Pointer *p;
+	const char *c;
+	size_t l;
+	switch (lua_type(L, idx)) {
+	case LUA_TLIGHTUSERDATA:
+		*(void **)dst = lua_touserdata(L, idx);
+		return dst;
+	case LUA_TUSERDATA:
+		p = luaL_testudata(L, idx, "dlffi_Pointer");
+		if (p == NULL) break;
+		*(void **)dst = p->pointer;
+		return dst;
+	case LUA_TSTRING:
+		c = lua_tolstring(L, idx, &l);
+		*(void **)dst = scratch_alloc(scratch, l + 1);
+		if (*(void **)dst == NULL) return NULL;
+		memcpy(*(void **)dst, c, l + 1);
+		return dst;
+	}
+	return type_write(L, idx, type, dst, func, scratch);
+}
+
+/* {{{ void *write_cstring(...) */
+//	pass Lua string without a copy if the scratch storage allows
+static void *write_cstring(
+	lua_State *L,
+	int idx,
+	ffi_type *type,
+	void *dst,
+	dlffi_Function *func,
+	dlffi_Scratch *scratch
+) {
+	(void)type;
+	if ( (lua_type(L, idx) == LUA_TSTRING) && scratch && scratch->borrow ) {
+		*(const char **)dst = lua_tostring(L, idx);
+		return dst;
+	}
+	return write_pointer(L, idx, &ffi_type_pointer, dst, func, scratch);
+}
+/* }}} write_cstring */
+/* }}} writers of Lua values */
+
+/* {{{ dlffi_Write type_writer(ffi_type *t) */
+dlffi_Write type_writer(ffi_type *t)
+{
+	if (t == &ffi_type_pointer) return write_pointer;
+	if (t == &dlffi_type_cstring) return write_cstring;
+	if (t == &ffi_type_float) return write_float;
+	if (t == &ffi_type_double) return write_double;
+	if (t == &ffi_type_longdouble) return write_longdouble;
+	if (t == &ffi_type_uint64) return write_uint64;
+	if (t == &ffi_type_sint64) return write_sint64;
+	if (t == &ffi_type_uint32) return write_uint32;
+	if (t == &ffi_type_sint32) return write_sint32;
+	if (t == &ffi_type_uint16) return write_uint16;
+	if (t == &ffi_type_sint16) return write_sint16;
+	if (t == &ffi_type_uint8) return write_uint8;
+	if (t == &ffi_type_sint8) return write_sint8;
+	return type_write;
+}
+/* }}} type_writer */
+
+/* {{{ dlffi_Op *plan_build(size_t argc, ffi_type **types, ffi_type *type) */
+//	choose converters for each argument and the return value
+dlffi_Op *plan_build(size_t argc, ffi_type **types, ffi_type *type)
+{
+	dlffi_Op *plan = malloc((argc + 1) * sizeof(dlffi_Op));
+	if (!plan) return NULL;
+	size_t i;
+	for (i = 0; i <= argc; i++) {
+		ffi_type *t = (i < argc) ? types[i] : type;
+		plan[i].type = t;
+		plan[i].push = type_pusher(t);
+		plan[i].write = type_writer(t);
+		plan[i].out = 0;
+	}
+	return plan;
+}
+/* }}} plan_build */
+
+/* {{{ dlffi_Op *plan_compile(dlffi_Function *o) */
+dlffi_Op *plan_compile(dlffi_Function *o)
+{
+	return plan_build(o->argc, o->types, o->type);
+}
+/* }}} plan_compile */
+
+/* {{{ struct dlffi_Type */
+// structure type created by dlffi_type_init()
+typedef struct dlffi_Type {
+	// must be the first member: the type is passed around as ffi_type *
+	ffi_type type;
+	// number of elements
+	size_t count;
+	// offsets of the elements
+	size_t *offsets;
+	// converters of the elements
+	dlffi_Op *ops;
+	// reference to the table of element names to their indexes
+	// and of the indexes of named elements to their names
+	int names;
+} dlffi_Type;
+/* }}} struct dlffi_Type */
+
+/* {{{ void type_destroy(lua_State *L, dlffi_Type *o) */
+static void type_destroy(lua_State *L, dlffi_Type *o)
+{
+	luaL_unref(L, LUA_REGISTRYINDEX, o->names);
+	free(o->type.elements);
+	free(o->offsets);
+	free(o->ops);
+	free(o);
+}
+/* }}} type_destroy */
+
+/* {{{ ffi_type *dlffi_type_init(table elements) */
+/* initialize a new structure type of the given elements */
+/* each element is either FFI type or { "name", FFI type } */
 /* return pointer to a new type or nothing on error */
 static int l_dlffi_type_init(lua_State *L) {
-	ffi_type *o = malloc(sizeof(ffi_type));
+	luaL_checktype(L, 1, LUA_TTABLE);
+	if (lua_checkstack(L, 6) == 0) return 0;
+	dlffi_Type *o = calloc(1, sizeof(dlffi_Type));
 	if (o == NULL) return 0;
+	o->names = LUA_NOREF;
 	// prepare the structure
-	luaL_checktype(L, 1, LUA_TTABLE);
 	size_t l = lua_objlen(L, 1);
-	o->size = o->alignment = 0;
-	o->type = FFI_TYPE_STRUCT;
-	o->elements = calloc(l + 1, sizeof(ffi_type *));
-	if (! o->elements) return 0;
-	o->elements[l] = NULL;
+	o->count = l;
+	o->type.size = o->type.alignment = 0;
+	o->type.type = FFI_TYPE_STRUCT;
+	o->type.elements = calloc(l + 1, sizeof(ffi_type *));
+	o->offsets = calloc(l + 1, sizeof(size_t));
+	o->ops = calloc(l + 1, sizeof(dlffi_Op));
+	if (!o->type.elements || !o->offsets || !o->ops) {
+		type_destroy(L, o);
+		return 0;
+	}
+	o->type.elements[l] = NULL;
 	// read the table
 	size_t i;
-	if (lua_checkstack(L, 4) == 0) return 0;
 	for (i = 0; i < l; i++) {
-		lua_pushinteger(L, (lua_Integer)i + 1);
-		lua_gettable(L, 1);
-		luaL_checktype(L, -1, LUA_TLIGHTUSERDATA);
-		o->elements[i] = lua_touserdata(L, -1);
-		if (! o->elements[i]) {
+		lua_rawgeti(L, 1, (lua_Integer)i + 1);
+		if (lua_type(L, -1) == LUA_TTABLE) {
+			// named element
+			lua_rawgeti(L, -1, 1);
+			lua_rawgeti(L, -2, 2);
+			if (lua_type(L, -2) != LUA_TSTRING) {
+				lua_pop(L, 3);
+				type_destroy(L, o);
+				lua_pushnil(L);
+				lua_pushfstring(L,
+					"Incorrect name of element #%d",
+					(int)i + 1
+				);
+				return 2;
+			}
+			if (o->names == LUA_NOREF) {
+				lua_newtable(L);
+				o->names = luaL_ref(L, LUA_REGISTRYINDEX);
+			}
+			lua_rawgeti(L, LUA_REGISTRYINDEX, o->names);
+			lua_pushvalue(L, -3);
+			lua_pushinteger(L, (lua_Integer)i + 1);
+			lua_rawset(L, -3);
+			lua_pushvalue(L, -3);
+			lua_rawseti(L, -2, (lua_Integer)i + 1);
+			lua_pop(L, 1);
+			lua_replace(L, -3);
+			lua_pop(L, 1);
+		}
+		if (lua_type(L, -1) == LUA_TLIGHTUSERDATA)
+			o->type.elements[i] = lua_touserdata(L, -1);
+		lua_pop(L, 1);
+		if (! o->type.elements[i]) {
+			type_destroy(L, o);
 			lua_pushnil(L);
 			lua_pushfstring(L,
 				"Incorrect FFI type #%d",
-				(lua_Integer)i + 1
+				(int)i + 1
 			);
 			return 2;
 		}
-		lua_pop(L, 1);
+		o->ops[i].type = o->type.elements[i];
+		o->ops[i].push = type_pusher(o->type.elements[i]);
+		o->ops[i].write = type_writer(o->type.elements[i]);
+	}
+	// init the type and lay out its elements
+	if (ffi_get_struct_offsets(
+		FFI_DEFAULT_ABI, &o->type, o->offsets
+	) != FFI_OK) {
+		type_destroy(L, o);
+		lua_pushnil(L);
+		lua_pushstring(L, "ffi_get_struct_offsets() failed");
+		return 2;
 	}
-	// init the type
-	ffi_cif cif;
-	ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 0, o, NULL);
 	lua_pushlightuserdata(L, o);
 	return 1;
 }
@@ -286,54 +863,79 @@ static int l_dlffi_type_init(lua_State *L) {
 /* {{{ void dlffi_type_free(ffi_type *) */
 static int l_dlffi_type_free(lua_State *L) {
 	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
-	ffi_type *o = lua_touserdata(L, 1);
-	if (o) {
-		free(o->elements);
-		free(o);
-	}
+	dlffi_Type *o = lua_touserdata(L, 1);
+	if (o) type_destroy(L, o);
 	return 0;
 }
 /* }}} dlffi_type_free */
 
+/* {{{ size_t type_field(lua_State *L, ffi_type *t, int idx) */
+//	find the element of the structure type by the index or the name
+//	at the given stack position
+//	Return: index of the element starting from 1 or 0 if not found
+size_t type_field(lua_State *L, ffi_type *t, int idx)
+{
+	dlffi_Type *o = (dlffi_Type *)t;
+	if ((t == NULL) || (t->type != FFI_TYPE_STRUCT)) return 0;
+	lua_Integer n = 0;
+	switch (lua_type(L, idx)) {
+	case LUA_TNUMBER:
+		n = lua_tointeger(L, idx);
+		break;
+	case LUA_TSTRING:
+		if (o->names == LUA_NOREF) return 0;
+		if (lua_checkstack(L, 2) == 0) return 0;
+		lua_rawgeti(L, LUA_REGISTRYINDEX, o->names);
+		lua_pushvalue(L, idx);
+		lua_rawget(L, -2);
+		n = lua_tointeger(L, -1);
+		lua_pop(L, 2);
+		break;
+	}
+	if ((n < 1) || ((size_t)n > o->count)) return 0;
+	return (size_t)n;
+}
+/* }}} type_field */
+
 /* {{{ size_t type_offset(ffi_type *, size_t n) */
 size_t type_offset(ffi_type *o, size_t n)
 {
 	if (o->type != FFI_TYPE_STRUCT) return 0;
-	size_t offset = 0;
-	size_t i;
-	for (i = 0; i < n; i++) {
-		ffi_type *e = o->elements[i];
-		offset += e->size + (
-			(
-			(size_t)e->alignment +
-				(
-				(offset - 1)
-				&
-				~((size_t)e->alignment - 1)
-				)
-			) - offset
-		);
-	}
-	offset -= o->elements[n - 1]->size;
-	if (offset >= o->size) return 0;
-	return offset;
+	if ((n < 1) || (n > ((dlffi_Type *)o)->count)) return 0;
+	return ((dlffi_Type *)o)->offsets[n - 1];
 }
 /* }}} type_offset */
 
-/* {{{ void dlffi_type_offset(ffi_type *, lua_Integer n) */
+/* {{{ void dlffi_type_offset(ffi_type *, lua_Integer n | char *name) */
 static int l_dlffi_type_offset(lua_State *L) {
 	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
 	ffi_type *o = lua_touserdata(L, 1);
 	if (!o) return 0;
-	lua_Integer n = luaL_checkinteger(L, 2);
+	size_t n = type_field(L, o, 2);
 	if (n < 1) return 0;
 	if (lua_checkstack(L, 1) == 0) return 0;
-	lua_pushinteger(L, (lua_Integer)type_offset(o, (size_t)n));
+	lua_pushinteger(L, (lua_Integer)type_offset(o, n));
 	return 1;
 }
 /* }}} dlffi_type_offset */
 
-/* {{{ void dlffi_type_element(void *o, ffi_type *, lua_Integer idx) */
+/* {{{ int type_element(lua_State *L, void *p, ffi_type *t, size_t n, int val) */
+//	read the n-th element of the structure or write the value
+//	at the stack index val to it, if val is non-zero
+int type_element(lua_State *L, void *p, ffi_type *t, size_t n, int val)
+{
+	dlffi_Type *o = (dlffi_Type *)t;
+	dlffi_Op *op = &(o->ops[n - 1]);
+	void *dst = (char *)p + o->offsets[n - 1];
+	if (lua_checkstack(L, 1) == 0) return 0;
+	if (val == 0) return op->push(L, dst);
+	void *u = op->write(L, val, op->type, dst, NULL, NULL);
+	lua_pushboolean(L, (u == NULL) ? 0 : 1);
+	return 1;
+}
+/* }}} type_element */
+
+/* {{{ void dlffi_type_element(void *o, ffi_type *, lua_Integer idx | char *name) */
 static int l_dlffi_type_element(lua_State *L) {
 	inline int report(const char *msg) {
 		if (lua_checkstack(L, 2) == 0) return 0;
@@ -353,260 +955,2285 @@ static int l_dlffi_type_element(lua_State *L) {
 		return report("pointer expected");
 	}
 	ffi_type *t = lua_touserdata(L, 2);
-	if (t->type != FFI_TYPE_STRUCT)
+	if ((t == NULL) || (t->type != FFI_TYPE_STRUCT))
 		return report("FFI type is not a structure");
-	lua_Integer n = lua_tointeger(L, 3);
+	size_t n = type_field(L, t, 3);
 	if (n < 1) return report("invalid element index");
-	if (lua_gettop(L) < 4) {
-		return type_push(L, p + type_offset(t, n), t->elements[n-1]);
-	} else {
-		void *u = type_write(
-			L,
-			4,
-			t->elements[n - 1],
-			p + type_offset(t, n),
-			NULL
-		);
-		if (lua_checkstack(L, 1) == 0) return 0;
-		lua_pushboolean(L, (u == NULL) ? 0 : 1);
-		return 1;
-	}
+	return type_element(L, p, t, n, (lua_gettop(L) < 4) ? 0 : 4);
 }
 /* }}} dlffi_type_element */
 
-// {{{ void dlffi_closure_run(ffi_cif *, void *, void **, dlffi_Function *)
-static void dlffi_closure_run(
-	ffi_cif *cif,
-	void *ret,
-	void **argv,
-	dlffi_Function *o
-) {
-	int top = lua_gettop(o->L);
-	if (lua_checkstack(o->L, 1 + cif->nargs) == 0) return;
-	lua_rawgeti(o->L, LUA_REGISTRYINDEX, o->ref);
-	unsigned i = 0;
-	for (; i < cif->nargs; i++) {
-		if (! type_push(o->L, argv[i], o->cif.arg_types[i])) {
-			i = (unsigned)-1;
-			break;
-		};
+/* {{{ void type_key(lua_State *L, int names, size_t n) */
+//	push the key of the n-th element in decoded tables:
+//	its name from the table at the index names, or its index
+static void type_key(lua_State *L, int names, size_t n)
+{
+	if (lua_type(L, names) == LUA_TTABLE) {
+		if (lua_rawgeti(L, names, (lua_Integer)n) != LUA_TNIL) return;
+		lua_pop(L, 1);
 	}
-	int r;
-	if (i != (unsigned)-1) {
-		if (o->type == &ffi_type_void)
-			r = lua_pcall(o->L, cif->nargs, 0, 0);
-		else {
-			bzero(ret, o->type->size);
-			r = lua_pcall(o->L, cif->nargs, 1, 0);
+	lua_pushinteger(L, (lua_Integer)n);
+}
+/* }}} type_key */
+
+/* {{{ void *type_array(lua_State *L, int idx) */
+//	pointer to an array of structures given as lightuserdata or
+//	dlffi_Pointer
+static void *type_array(lua_State *L, int idx)
+{
+	if (lua_type(L, idx) == LUA_TLIGHTUSERDATA)
+		return lua_touserdata(L, idx);
+	return (dlffi_check_Pointer(L, idx))->pointer;
+}
+/* }}} type_array */
+
+/* {{{ ffi_type *type_check(lua_State *L, int idx) */
+static ffi_type *type_check(lua_State *L, int idx)
+{
+	luaL_checktype(L, idx, LUA_TLIGHTUSERDATA);
+	ffi_type *t = lua_touserdata(L, idx);
+	luaL_argcheck(L, (t != NULL) && (t->type == FFI_TYPE_STRUCT), idx,
+		"FFI type is not a structure");
+	return t;
+}
+/* }}} type_check */
+
+/* {{{ table dlffi_type_decode(void *o, ffi_type *, n[, bool columnar]) */
+//	decode n consecutive structures into Lua tables keyed by
+//	element names (indexes for unnamed elements):
+//	row-wise	- array of n tables
+//	columnar	- table of arrays of n values, one per element
+static int l_dlffi_type_decode(lua_State *L) {
+	char *p = type_array(L, 1);
+	dlffi_Type *t = (dlffi_Type *)type_check(L, 2);
+	lua_Integer n = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, n >= 0, 3, "negative number of structures");
+	luaL_argcheck(L, (p != NULL) || (n == 0), 1, "NULL pointer");
+	int columnar = lua_toboolean(L, 4);
+	lua_settop(L, 4);
+	if (lua_checkstack(L, 6) == 0) return 0;
+	if (t->names == LUA_NOREF) lua_pushnil(L);
+	else lua_rawgeti(L, LUA_REGISTRYINDEX, t->names);
+	size_t size = t->type.size;
+	size_t i, row;
+	if (columnar) {
+		lua_createtable(L, 0, (int)t->count);
+		for (i = 0; i < t->count; i++) {
+			dlffi_Op *op = &(t->ops[i]);
+			char *e = p + t->offsets[i];
+			type_key(L, 5, i + 1);
+			lua_createtable(L, (int)n, 0);
+			for (row = 0; row < (size_t)n; row++, e += size) {
+				op->push(L, e);
+				lua_rawseti(L, -2, (lua_Integer)row + 1);
+			}
+			lua_rawset(L, -3);
 		}
-		if ((r == 0) && (o->type != &ffi_type_void)) {
-			// no errors and function has returned something
-			type_write(o->L, -1, o->type, ret, o);
+		return 1;
+	}
+	lua_createtable(L, (int)n, 0);
+	for (row = 0; row < (size_t)n; row++, p += size) {
+		lua_createtable(L, 0, (int)t->count);
+		for (i = 0; i < t->count; i++) {
+			type_key(L, 5, i + 1);
+			t->ops[i].push(L, p + t->offsets[i]);
+			lua_rawset(L, -3);
 		}
+		lua_rawseti(L, -2, (lua_Integer)row + 1);
 	}
-	lua_settop(o->L, top);
+	return 1;
 }
-// }}} dlffi_closure_run
+/* }}} dlffi_type_decode */
 
-/* {{{ dlffi_Function *l_dlffi_create(
-	void (*function)(),
-	ffi_type *rtype,
-	ffi_type **argument types
-	)
-*/
-static int l_dlffi_create(lua_State *L) {
-	size_t i;
-	if (lua_checkstack(L, 5) == 0) return 0;
-	dlffi_Function *o = (dlffi_Function *)
-		lua_newuserdata(L, sizeof(dlffi_Function));
-	if (!o) return 0;
-	o->types = NULL;
-	o->dlhdl = NULL;
-	o->dlsym = NULL;
-	o->ret = NULL;
-	o->ref = LUA_REFNIL;
-	o->closure = NULL;
-	o->ref_table = LUA_REFNIL;
-	/* set the FFI type of a return value */
-	o->type = lua_touserdata(L, 2);
-	if (! o->type) {
+/* {{{ n dlffi_type_encode(void *o, ffi_type *, table[, bool columnar[, dlffi_Arena]]) */
+//	pack Lua tables, as returned by dlffi_type_decode(), into
+//	consecutive structures; missing values are zeroed,
+//	strings are copied to the arena, which a destination dlffi_Pointer
+//	then keeps alive, and refused without one
+//	the buffer must have room for all the rows; the rows before
+//	a failed element are left written
+//	Return: number of the written structures
+static int l_dlffi_type_encode(lua_State *L) {
+	char *p = type_array(L, 1);
+	luaL_argcheck(L, ! pointer_readonly((dlffi_Pointer *)value_mapping(L, 1)),
+		1, "read-only mapping");
+	dlffi_Type *t = (dlffi_Type *)type_check(L, 2);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	int columnar = lua_toboolean(L, 4);
+	dlffi_Scratch s = { NULL, 0, NULL, 0, NULL };
+	if (! lua_isnoneornil(L, 5))
+		s.arena = luaL_checkudata(L, 5, "dlffi_Arena");
+	lua_settop(L, 5);
+	if (lua_checkstack(L, 6) == 0) return 0;
+	if (t->names == LUA_NOREF) lua_pushnil(L);
+	else lua_rawgeti(L, LUA_REGISTRYINDEX, t->names);
+	size_t size = t->type.size;
+	size_t i, row, n = 0;
+	// the failed element is zeroed, a spilled copy is not left behind
+	inline int report(char *e, size_t i, size_t row) {
+		bzero(e, t->ops[i].type->size);
 		lua_pushnil(L);
-		lua_pushstring(L,
-			"Incorrect return value FFI type specified");
+		if (s.spill) {
+			scratch_free(&s);
+			lua_pushfstring(L, "element #%d of row #%d is a string, "
+				"but no arena is given", (int)i + 1, (int)row + 1);
+		} else lua_pushfstring(L, "cannot write element #%d of row #%d",
+			(int)i + 1, (int)row + 1);
 		return 2;
 	}
-	luaL_getmetatable(L, "dlffi_Function");
-	lua_setmetatable(L, -2);
-	/* iterate through argument FFI types */
-	luaL_checktype(L, 3, LUA_TTABLE);
-	size_t l = lua_objlen(L, 3);
-	o->types = calloc(l + 1, sizeof(ffi_type *));
-	if (! o->types) return 0;
-	o->types[l] = NULL;
-	for (i = 1; i <= l; i++) {
-		lua_pushinteger(L, (lua_Integer)i);
-		lua_gettable(L, 3);
-		o->types[i - 1] = lua_touserdata(L, -1);
-		if (! o->types[i-1]) {
-			lua_pushnil(L);
-			lua_pushfstring(L,
-				"Incorrect argment FFI type #%d",
-				(lua_Integer)i
-			);
-			return 2;
+	if (columnar) {
+		// the longest column defines the number of rows
+		for (i = 0; i < t->count; i++) {
+			type_key(L, 6, i + 1);
+			if (lua_rawget(L, 3) == LUA_TTABLE) {
+				if (lua_rawlen(L, -1) > n) n = lua_rawlen(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+	} else n = lua_rawlen(L, 3);
+	luaL_argcheck(L, (p != NULL) || (n == 0), 1, "NULL pointer");
+	// the pointer owns the string copies
+	if (s.arena && luaL_testudata(L, 1, "dlffi_Pointer"))
+		pointer_pin(L, 1, 5);
+	if (columnar) {
+		for (i = 0; i < t->count; i++) {
+			dlffi_Op *op = &(t->ops[i]);
+			char *e = p + t->offsets[i];
+			type_key(L, 6, i + 1);
+			int column = lua_rawget(L, 3) == LUA_TTABLE;
+			for (row = 0; row < n; row++, e += size) {
+				if (!column || lua_rawgeti(
+					L, -1, (lua_Integer)row + 1
+				) == LUA_TNIL) {
+					bzero(e, op->type->size);
+				} else if ((op->write(
+					L, -1, op->type, e, NULL, &s
+				) == NULL) || s.spill) return report(e, i, row);
+				if (column) lua_pop(L, 1);
+			}
+			lua_pop(L, 1);
+		}
+	} else {
+		for (row = 0; row < n; row++, p += size) {
+			if (lua_rawgeti(L, 3, (lua_Integer)row + 1) != LUA_TTABLE) {
+				lua_pop(L, 1);
+				bzero(p, size);
+				continue;
+			}
+			for (i = 0; i < t->count; i++) {
+				dlffi_Op *op = &(t->ops[i]);
+				char *e = p + t->offsets[i];
+				type_key(L, 6, i + 1);
+				if (lua_rawget(L, -2) == LUA_TNIL) {
+					bzero(e, op->type->size);
+				} else if ((op->write(
+					L, -1, op->type, e, NULL, &s
+				) == NULL) || s.spill) return report(e, i, row);
+				lua_pop(L, 1);
+			}
+			lua_pop(L, 1);
 		}
-		lua_pop(L, 1);
-	}
-	ffi_status stat = ffi_prep_cif(
-		&o->cif,
-		FFI_DEFAULT_ABI,
-		(unsigned int) l,
-		o->type,
-		o->types
-	);
-	if (stat != FFI_OK) {
-		lua_pushnil(L);
-		lua_pushstring(L, "ffi_prep_cif() failed");
-		return 2;
 	}
-	o->ret = malloc(o->type->size);
-	o->closure = ffi_closure_alloc(sizeof(ffi_closure), &(o->dlsym));
-	lua_pushvalue(L, 1);
+	lua_pushinteger(L, (lua_Integer)n);
+	return 1;
+}
+/* }}} dlffi_type_encode */
+
+/* {{{ dlffi_Struct dlffi_type_view(void *o, ffi_type *) */
+//	the view keeps the given dlffi_Pointer alive, but not the type
+static int l_dlffi_type_view(lua_State *L) {
+	void *p = type_array(L, 1);
+	ffi_type *t = type_check(L, 2);
+	if (lua_checkstack(L, 2) == 0) return 0;
+	dlffi_Struct *o = lua_newuserdata(L, sizeof(dlffi_Struct));
+	if (!o) return 0;
+	o->pointer = p;
+	o->owner = luaL_testudata(L, 1, "dlffi_Pointer");
+	o->type = t;
+	luaL_getmetatable(L, "dlffi_Struct");
+	lua_setmetatable(L, -2);
+	lua_pushvalue(L, 1);
+	lua_setuservalue(L, -2);
+	return 1;
+}
+/* }}} dlffi_type_view */
+
+/* {{{ dlffi_Struct_index(dlffi_Struct, name) */
+static int dlffi_Struct_index(lua_State *L) {
+	dlffi_Struct *o = luaL_checkudata(L, 1, "dlffi_Struct");
+	size_t n = type_field(L, o->type, 2);
+	void *p = struct_base(o);
+	if ((n < 1) || (p == NULL)) return 0;
+	return type_element(L, p, o->type, n, 0);
+}
+/* }}} dlffi_Struct_index */
+
+/* {{{ dlffi_Struct_newindex(dlffi_Struct, name, value) */
+static int dlffi_Struct_newindex(lua_State *L) {
+	dlffi_Struct *o = luaL_checkudata(L, 1, "dlffi_Struct");
+	size_t n = type_field(L, o->type, 2);
+	void *p = struct_base(o);
+	if ((n < 1) || (p == NULL))
+		return luaL_error(L, "invalid element %s",
+			luaL_tolstring(L, 2, NULL));
+	if (pointer_readonly(o->owner))
+		return luaL_error(L, "cannot write element %s: "
+			"read-only mapping", luaL_tolstring(L, 2, NULL));
+	type_element(L, p, o->type, n, 3);
+	if (! lua_toboolean(L, -1))
+		return luaL_error(L, "cannot write element %s",
+			luaL_tolstring(L, 2, NULL));
+	return 0;
+}
+/* }}} dlffi_Struct_newindex */
+
+/* {{{ cache of dynamic libraries */
+static dlffi_Library *dlffi_libs = NULL;
+static pthread_mutex_t dlffi_libs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* {{{ size_t symbol_hash(const char *name) */
+static size_t symbol_hash(const char *name)
+{
+	size_t h = 5381;
+	while (*name) h = h * 33 + (unsigned char)*name++;
+	return h;
+}
+/* }}} symbol_hash */
+
+/* {{{ dlffi_Library *lib_open(const char *path, char *e, size_t size) */
+//	take a reference to the shared handler of the library,
+//	opening it on the first use
+//	e	- buffer for the error message
+//	Return: NULL on error
+dlffi_Library *lib_open(const char *path, char *e, size_t size)
+{
+	dlffi_Library *lib;
+	pthread_mutex_lock(&dlffi_libs_lock);
+	for (lib = dlffi_libs; lib; lib = lib->next) {
+		if (strcmp(lib->path, path) == 0) break;
+	}
+	if (lib) {
+		lib->refs += 1;
+		pthread_mutex_unlock(&dlffi_libs_lock);
+		return lib;
+	}
+	lib = calloc(1, sizeof(dlffi_Library));
+	if (lib) lib->path = strdup(path);
+	if (!lib || !lib->path) {
+		if (lib) free(lib);
+		pthread_mutex_unlock(&dlffi_libs_lock);
+		snprintf(e, size, "memory allocation error");
+		return NULL;
+	}
+	lib->dlhdl = dlopen((*path == 0) ? NULL : path, RTLD_LAZY);
+	if (! lib->dlhdl) {
+		snprintf(e, size, "dlopen() failed: %s", dlerror());
+		pthread_mutex_unlock(&dlffi_libs_lock);
+		free(lib->path);
+		free(lib);
+		return NULL;
+	}
+	lib->refs = 1;
+	lib->next = dlffi_libs;
+	dlffi_libs = lib;
+	pthread_mutex_unlock(&dlffi_libs_lock);
+	return lib;
+}
+/* }}} lib_open */
+
+/* {{{ void lib_close(dlffi_Library *lib) */
+//	drop a reference to the shared handler,
+//	the last one closes the library
+void lib_close(dlffi_Library *lib)
+{
+	if (!lib) return;
+	pthread_mutex_lock(&dlffi_libs_lock);
+	lib->refs -= 1;
+	if (lib->refs > 0) {
+		pthread_mutex_unlock(&dlffi_libs_lock);
+		return;
+	}
+	dlffi_Library **p = &dlffi_libs;
+	while (*p != lib) p = &((*p)->next);
+	*p = lib->next;
+	dlclose(lib->dlhdl);
+	dlerror();
+	pthread_mutex_unlock(&dlffi_libs_lock);
+	size_t i;
+	for (i = 0; i < lib->nbuckets; i++) {
+		while (lib->symbols[i]) {
+			dlffi_Symbol *sym = lib->symbols[i];
+			lib->symbols[i] = sym->next;
+			free(sym->name);
+			free(sym);
+		}
+	}
+	free(lib->symbols);
+	free(lib->path);
+	free(lib);
+}
+/* }}} lib_close */
+
+/* {{{ dlffi_Symbol *lib_sym(dlffi_Library *lib, const char *name, ...) */
+//	resolve the symbol, remembering the resolved address
+//	e	- buffer for the error message
+//	Return: NULL on error
+dlffi_Symbol *lib_sym(
+	dlffi_Library *lib,
+	const char *name,
+	char *e,
+	size_t size
+) {
+	size_t h = symbol_hash(name);
+	dlffi_Symbol *sym;
+	pthread_mutex_lock(&dlffi_libs_lock);
+	if (lib->nbuckets) {
+		sym = lib->symbols[h % lib->nbuckets];
+		for (; sym; sym = sym->next) {
+			if (strcmp(sym->name, name) == 0) {
+				pthread_mutex_unlock(&dlffi_libs_lock);
+				return sym;
+			}
+		}
+	}
+	dlerror();
+	void *address = dlsym(lib->dlhdl, name);
+	char *err = dlerror();
+	if (err) {
+		snprintf(e, size, "dlsym() failed: %s", err);
+		pthread_mutex_unlock(&dlffi_libs_lock);
+		return NULL;
+	}
+	// grow the table keeping two symbols per bucket on average
+	if (lib->nsymbols >= 2 * lib->nbuckets) {
+		size_t n = lib->nbuckets ? 2 * lib->nbuckets : 16;
+		dlffi_Symbol **b = calloc(n, sizeof(dlffi_Symbol *));
+		if (!b) goto nomem;
+		size_t i;
+		for (i = 0; i < lib->nbuckets; i++) {
+			while (lib->symbols[i]) {
+				sym = lib->symbols[i];
+				lib->symbols[i] = sym->next;
+				size_t j = symbol_hash(sym->name) % n;
+				sym->next = b[j];
+				b[j] = sym;
+			}
+		}
+		free(lib->symbols);
+		lib->symbols = b;
+		lib->nbuckets = n;
+	}
+	sym = malloc(sizeof(dlffi_Symbol));
+	if (!sym) goto nomem;
+	sym->name = strdup(name);
+	if (!sym->name) {
+		free(sym);
+		goto nomem;
+	}
+	sym->address = address;
+	sym->next = lib->symbols[h % lib->nbuckets];
+	lib->symbols[h % lib->nbuckets] = sym;
+	lib->nsymbols += 1;
+	pthread_mutex_unlock(&dlffi_libs_lock);
+	return sym;
+nomem:
+	pthread_mutex_unlock(&dlffi_libs_lock);
+	snprintf(e, size, "memory allocation error");
+	return NULL;
+}
+/* }}} lib_sym */
+/* }}} cache of dynamic libraries */
+
+/* {{{ size_t frame_args(size_t argc, ffi_type **types, void **argv) */
+//	lay out NULL-terminated argument pointers followed by argument
+//	values in the given buffer
+//	Return: size of the laid out part
+size_t frame_args(size_t argc, ffi_type **types, void **argv)
+{
+	const size_t align = 16;
+	size_t size = (argc + 1) * sizeof(void *);
+	size_t i;
+	for (i = 0; i < argc; i++) {
+		size = (size + align - 1) & ~(align - 1);
+		if (argv) argv[i] = (char *)argv + size;
+		if (types[i]->size < sizeof(ffi_arg))
+			size += sizeof(ffi_arg);
+		else size += types[i]->size;
+	}
+	if (argv) argv[argc] = NULL;
+	return size;
+}
+/* }}} frame_args */
+
+/* {{{ size_t frame_layout(dlffi_Function *o, void **argv) */
+//	lay out the call frame in the given buffer:
+//	arguments as by frame_args() followed by buffers of output
+//	arguments, whose offsets go to the plan
+//	Return: size of the frame
+size_t frame_layout(dlffi_Function *o, void **argv)
+{
+	const size_t align = 16;
+	size_t size = frame_args(o->argc, o->types, argv);
+	size_t i;
+	for (i = 0; i < o->nouts; i++) {
+		dlffi_Op *op = &(o->plan[o->outs[i]]);
+		size = (size + align - 1) & ~(align - 1);
+		op->out = size;
+		// whole slots tolerate a slightly understated pointed type
+		size += (op->type->size + align - 1) & ~(align - 1);
+	}
+	return size;
+}
+/* }}} frame_layout */
+
+/* {{{ interned signatures */
+// native call stub: calls fn with the arguments pointed by argv
+typedef void (*dlffi_Stub)(void *fn, void **argv, void *ret);
+
+/* {{{ struct dlffi_Sig */
+// call interface parsed from a signature string like "p(ppi)"
+typedef struct dlffi_Sig {
+	char *key;
+	ffi_cif cif;
+	ffi_type *type;
+	ffi_type **types;
+	size_t argc;
+	int variadic;
+	// converters of the arguments and the return value
+	dlffi_Op *plan;
+	// generated call stub or NULL to use ffi_call()
+	dlffi_Stub stub;
+	struct dlffi_Sig *next;
+} dlffi_Sig;
+/* }}} struct dlffi_Sig */
+
+static dlffi_Sig *dlffi_sigs = NULL;
+static pthread_mutex_t dlffi_sigs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* {{{ ffi_type *sig_type(char c) */
+//	FFI type of a signature letter
+static ffi_type *sig_type(char c)
+{
+	switch (c) {
+	case 'v': return &ffi_type_void;
+	case 'c': return &ffi_type_schar;
+	case 'C': return &ffi_type_uchar;
+	case 'h': return &ffi_type_sshort;
+	case 'H': return &ffi_type_ushort;
+	case 'i': return &ffi_type_sint;
+	case 'I': return &ffi_type_uint;
+	case 'l': return &ffi_type_slong;
+	case 'L': return &ffi_type_ulong;
+	case 'q': return &ffi_type_sint64;
+	case 'Q': return &ffi_type_uint64;
+	case 'f': return &ffi_type_float;
+	case 'd': return &ffi_type_double;
+	case 'D': return &ffi_type_longdouble;
+	case 'p': return &ffi_type_pointer;
+	case 's': return &dlffi_type_cstring;
+	case 'z':
+		return (sizeof(size_t) == 8) ? &ffi_type_uint64 :
+			&ffi_type_uint32;
+	default: return NULL;
+	}
+}
+/* }}} sig_type */
+
+/* {{{ dlffi_Stub stub_emit(dlffi_Sig *sig) */
+//	generate x86-64 System V call stub for the signature of integer,
+//	pointer, float and double values passed in registers only;
+//	DLFFI_JIT=0 in the environment disables the stubs
+//	Return: NULL if the signature is not supported
+static dlffi_Stub stub_emit(dlffi_Sig *sig)
+{
+#if defined(__x86_64__)
+	// rdi, rsi, rdx, rcx, r8, r9
+	static const unsigned char gpr[] = { 7, 6, 2, 1, 8, 9 };
+	unsigned char code[512];
+	size_t n = 0, i, ngpr = 0, nsse = 0;
+	inline void emit(int count, ...) {
+		va_list ap;
+		va_start(ap, count);
+		while (count--) code[n++] = (unsigned char)va_arg(ap, int);
+		va_end(ap);
+	};
+	// class of a type: 1 - integer, 2 - float, 3 - double, 0 - other
+	inline int cls(ffi_type *t) {
+		switch (t->type) {
+		case FFI_TYPE_FLOAT: return 2;
+		case FFI_TYPE_DOUBLE: return 3;
+		case FFI_TYPE_STRUCT:
+		case FFI_TYPE_LONGDOUBLE: return 0;
+		}
+		return (t->size <= 8) ? 1 : 0;
+	};
+	const char *env = getenv("DLFFI_JIT");
+	if (env && (strcmp(env, "0") == 0)) return NULL;
+	if (sig->variadic) return NULL;
+	if ( (sig->type != &ffi_type_void) && (cls(sig->type) == 0) )
+		return NULL;
+	for (i = 0; i < sig->argc; i++) {
+		int c = cls(sig->types[i]);
+		if (c == 0) return NULL;
+		if (c == 1) ngpr++; else nsse++;
+	}
+	if ( (ngpr > 6) || (nsse > 8) ) return NULL;
+	// push rbx; mov rbx, rdx; mov r11, rdi; mov r10, rsi
+	emit(1, 0x53);
+	emit(3, 0x48, 0x89, 0xd3);
+	emit(3, 0x49, 0x89, 0xfb);
+	emit(3, 0x49, 0x89, 0xf2);
+	ngpr = nsse = 0;
+	for (i = 0; i < sig->argc; i++) {
+		ffi_type *t = sig->types[i];
+		// mov rax, [r10 + 8 * i]
+		emit(4, 0x49, 0x8b, 0x42, (int)(8 * i));
+		switch (cls(t)) {
+		case 2: // movss xmmN, [rax]
+			emit(4, 0xf3, 0x0f, 0x10, (int)(nsse++ << 3));
+			continue;
+		case 3: // movsd xmmN, [rax]
+			emit(4, 0xf2, 0x0f, 0x10, (int)(nsse++ << 3));
+			continue;
+		}
+		int r = gpr[ngpr++];
+		int rex = (r & 8) ? 0x44 : 0;
+		int modrm = (r & 7) << 3;
+		switch (t->size) {
+		case 8: // mov r64, [rax]
+			emit(3, 0x48 | rex, 0x8b, modrm);
+			break;
+		case 4: // mov r32, [rax]
+			if (rex) emit(1, rex);
+			emit(2, 0x8b, modrm);
+			break;
+		default: // movsx/movzx r32, byte/word [rax]
+			if (rex) emit(1, rex);
+			emit(3, 0x0f, ((t->size == 1) ? 0xb6 : 0xb7) |
+				((t->type == FFI_TYPE_SINT8) ||
+				(t->type == FFI_TYPE_SINT16) ? 0x08 : 0),
+				modrm);
+		}
+	}
+	// call r11
+	emit(3, 0x41, 0xff, 0xd3);
+	// widen the return value to ffi_arg as ffi_call() does
+	ffi_type *t = sig->type;
+	switch ((t == &ffi_type_void) ? -1 : cls(t)) {
+	case -1:
+		break;
+	case 2: // movss [rbx], xmm0
+		emit(4, 0xf3, 0x0f, 0x11, 0x03);
+		break;
+	case 3: // movsd [rbx], xmm0
+		emit(4, 0xf2, 0x0f, 0x11, 0x03);
+		break;
+	default:
+		switch (t->type) {
+		case FFI_TYPE_SINT8: // movsx rax, al
+			emit(4, 0x48, 0x0f, 0xbe, 0xc0);
+			break;
+		case FFI_TYPE_UINT8: // movzx eax, al
+			emit(3, 0x0f, 0xb6, 0xc0);
+			break;
+		case FFI_TYPE_SINT16: // movsx rax, ax
+			emit(4, 0x48, 0x0f, 0xbf, 0xc0);
+			break;
+		case FFI_TYPE_UINT16: // movzx eax, ax
+			emit(3, 0x0f, 0xb7, 0xc0);
+			break;
+		case FFI_TYPE_SINT32: // movsxd rax, eax
+		case FFI_TYPE_INT:
+			emit(3, 0x48, 0x63, 0xc0);
+			break;
+		case FFI_TYPE_UINT32: // mov eax, eax
+			emit(2, 0x89, 0xc0);
+			break;
+		}
+		// mov [rbx], rax
+		emit(3, 0x48, 0x89, 0x03);
+	}
+	// pop rbx; ret
+	emit(2, 0x5b, 0xc3);
+	// a page per stub, never written once executable
+	size_t page = sysconf(_SC_PAGESIZE);
+	void *p = mmap(NULL, page, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) return NULL;
+	memcpy(p, code, n);
+	if (mprotect(p, page, PROT_READ | PROT_EXEC) != 0) {
+		munmap(p, page);
+		return NULL;
+	}
+	return (dlffi_Stub)p;
+#else
+	(void)sig;
+	return NULL;
+#endif
+}
+/* }}} stub_emit */
+
+/* {{{ dlffi_Sig *sig_parse(const char *key, char *e, size_t size) */
+//	parse the signature: return type letter, then argument type
+//	letters in parentheses, optionally ended by "..."
+//	Return: NULL on error with the message in e
+static dlffi_Sig *sig_parse(const char *key, char *e, size_t size)
+{
+	size_t len = strlen(key), i, argc = 0;
+	int variadic = 0;
+	inline dlffi_Sig *report(const char *msg) {
+		snprintf(e, size, "signature \"%s\": %s", key, msg);
+		return NULL;
+	};
+	if ( (len < 3) || (key[1] != '(') || (key[len - 1] != ')') )
+		return report("must look like \"p(pi)\"");
+	if ( (len >= 6) && (strncmp(key + len - 4, "...)", 4) == 0) ) {
+		variadic = 1;
+		argc = len - 6;
+	} else argc = len - 3;
+	ffi_type *type = sig_type(key[0]);
+	if (! type) return report("unknown return type");
+	dlffi_Sig *sig = calloc(1, sizeof(dlffi_Sig));
+	if (! sig) return report("memory allocation error");
+	sig->key = strdup(key);
+	sig->types = calloc(argc + 1, sizeof(ffi_type *));
+	if ( (! sig->key) || (! sig->types) ) goto fail;
+	for (i = 0; i < argc; i++) {
+		sig->types[i] = sig_type(key[i + 2]);
+		if ( (! sig->types[i]) || (sig->types[i] == &ffi_type_void) ) {
+			snprintf(e, size, "signature \"%s\": "
+				"bad argument type #%d", key, (int)i + 1);
+			goto fail2;
+		}
+	}
+	sig->type = type;
+	sig->argc = argc;
+	sig->variadic = variadic;
+	if (ffi_prep_cif(&(sig->cif), FFI_DEFAULT_ABI, argc, type,
+		sig->types) != FFI_OK
+	) {
+		report("ffi_prep_cif() failed");
+		goto fail2;
+	}
+	sig->plan = plan_build(argc, sig->types, type);
+	if (! sig->plan) goto fail;
+	sig->stub = stub_emit(sig);
+	return sig;
+fail:
+	report("memory allocation error");
+fail2:
+	free(sig->key);
+	free(sig->types);
+	free(sig);
+	return NULL;
+}
+/* }}} sig_parse */
+
+/* {{{ dlffi_Sig *sig_get(const char *key, char *e, size_t size) */
+//	find the interned signature or parse and intern it
+//	Return: NULL on error with the message in e
+static dlffi_Sig *sig_get(const char *key, char *e, size_t size)
+{
+	dlffi_Sig *sig;
+	pthread_mutex_lock(&dlffi_sigs_lock);
+	for (sig = dlffi_sigs; sig; sig = sig->next)
+		if (strcmp(sig->key, key) == 0) break;
+	if (! sig) {
+		sig = sig_parse(key, e, size);
+		if (sig) {
+			sig->next = dlffi_sigs;
+			dlffi_sigs = sig;
+		}
+	}
+	pthread_mutex_unlock(&dlffi_sigs_lock);
+	return sig;
+}
+/* }}} sig_get */
+/* }}} interned signatures */
+
+/* {{{ void func_call(dlffi_Function *o, void *ret, void **argv) */
+//	call the native function through the stub of its signature, if any
+static inline void func_call(dlffi_Function *o, void *ret, void **argv)
+{
+	if (o->stub) o->stub(o->dlsym, argv, ret);
+	else ffi_call(o->cif, o->dlsym, ret, argv);
+}
+/* }}} func_call */
+
+/* {{{ int strbuf_reserve(dlffi_Function *o, dlffi_Scratch *s, size_t size) */
+//	point the scratch storage to the string buffer of the function,
+//	growing the buffer to hold at least size bytes
+int strbuf_reserve(dlffi_Function *o, dlffi_Scratch *s, size_t size)
+{
+	if (size > o->strbuf_size) {
+		char *buf = realloc(o->strbuf, size);
+		if (!buf) return 0;
+		o->strbuf = buf;
+		o->strbuf_size = size;
+	}
+	s->buf = o->strbuf;
+	s->left = size;
+	return 1;
+}
+/* }}} strbuf_reserve */
+
+/* {{{ void frame_release(dlffi_Function *o) */
+// string buffers grown over this by a long argument are not kept
+#define DLFFI_STRBUF_KEEP 16384
+//	give the preallocated frame back once the call is finished
+static void frame_release(dlffi_Function *o)
+{
+	o->busy = 0;
+	if (o->strbuf_size > DLFFI_STRBUF_KEEP) {
+		free(o->strbuf);
+		o->strbuf = NULL;
+		o->strbuf_size = 0;
+	}
+}
+/* }}} frame_release */
+
+/* {{{ void frame_guard(lua_State *L) */
+//	errors raised while the arguments are converted skip frame_release(),
+//	so the function at 1 is marked to be closed by dlffi_close() then;
+//	before Lua 5.4 such functions fall back to temporary frames
+static void frame_guard(lua_State *L)
+{
+#if LUA_VERSION_NUM >= 504
+	if ( lua_checkstack(L, 1) == 0 ) return;
+	lua_pushvalue(L, 1);
+	lua_toclose(L, -1);
+#else
+	(void)L;
+#endif
+}
+/* }}} frame_guard */
+
+/* {{{ dlffi_close(dlffi_Function, err) */
+//	release the frame of a call unwound by an error, see frame_guard()
+static int dlffi_close(lua_State *L) {
+	dlffi_Function *o = luaL_checkudata(L, 1, "dlffi_Function");
+	if (! lua_isnoneornil(L, 2)) frame_release(o);
+	return 0;
+}
+/* }}} dlffi_close */
+
+/* {{{ void **frame_acquire(...) */
+//	take the preallocated call frame with room for strsize bytes of
+//	strings; if the frame is in use by a running call (re-entrance),
+//	lay out a temporary one in a userdata pushed onto the stack
+//	Return: argument pointers or NULL on error
+void **frame_acquire(
+	lua_State *L,
+	dlffi_Function *o,
+	size_t strsize,
+	dlffi_Scratch *scratch
+) {
+	scratch->spill = NULL;
+	scratch->borrow = 1;
+	scratch->arena = NULL;
+	if (o->busy) {
+		if ( lua_checkstack(L, 1) == 0 ) return NULL;
+		void **argv = lua_newuserdata(L, o->frame_size + strsize);
+		if (!argv) return NULL;
+		frame_layout(o, argv);
+		scratch->buf = (char *)argv + o->frame_size;
+		scratch->left = strsize;
+		return argv;
+	}
+	if (! strbuf_reserve(o, scratch, strsize)) return NULL;
+	o->busy = 1;
+	frame_guard(L);
+	return o->argv;
+}
+/* }}} frame_acquire */
+
+/* {{{ struct dlffi_Call */
+// closure call queued by a foreign thread
+typedef struct dlffi_Call {
+	_Atomic(struct dlffi_Call *) next;
+	dlffi_Function *func;
+	void *ret;
+	void **argv;
+	// the caller waits on it, NULL for posted calls owning the memory
+	sem_t *done;
+} dlffi_Call;
+/* }}} struct dlffi_Call */
+
+/* {{{ struct dlffi_Queue */
+// lock-free multiple producers single consumer queue
+typedef struct dlffi_Queue {
+	_Atomic(dlffi_Call *) head;
+	dlffi_Call *tail;
+	dlffi_Call stub;
+	// the Lua state is closing, calls are not queued anymore
+	atomic_int closed;
+	// pushes in progress, see queue_offer()
+	atomic_int pushing;
+	// the registry and every closure using the queue own it
+	atomic_int refs;
+} dlffi_Queue;
+/* }}} struct dlffi_Queue */
+
+/* {{{ void queue_push(dlffi_Queue *q, dlffi_Call *c) */
+//	safe to call from any thread
+void queue_push(dlffi_Queue *q, dlffi_Call *c)
+{
+	atomic_store_explicit(&c->next, NULL, memory_order_relaxed);
+	dlffi_Call *prev = atomic_exchange_explicit(
+		&q->head, c, memory_order_acq_rel
+	);
+	atomic_store_explicit(&prev->next, c, memory_order_release);
+}
+/* }}} queue_push */
+
+/* {{{ int queue_offer(dlffi_Queue *q, dlffi_Call *c) */
+//	queue_push() unless the queue is closed, safe to call from any thread
+//	Return: 0 if the call is not queued
+int queue_offer(dlffi_Queue *q, dlffi_Call *c)
+{
+	atomic_fetch_add(&q->pushing, 1);
+	int open = ! atomic_load(&q->closed);
+	if (open) queue_push(q, c);
+	atomic_fetch_sub(&q->pushing, 1);
+	return open;
+}
+/* }}} queue_offer */
+
+/* {{{ void queue_release(dlffi_Queue *q) */
+void queue_release(dlffi_Queue *q)
+{
+	if (atomic_fetch_sub(&q->refs, 1) == 1) free(q);
+}
+/* }}} queue_release */
+
+/* {{{ dlffi_Call *queue_pop(dlffi_Queue *q) */
+//	only the thread owning the Lua state may call it
+//	Return: NULL if the queue is empty or a push is in progress
+dlffi_Call *queue_pop(dlffi_Queue *q)
+{
+	dlffi_Call *tail = q->tail;
+	dlffi_Call *next = atomic_load_explicit(
+		&tail->next, memory_order_acquire
+	);
+	if (tail == &q->stub) {
+		if (next == NULL) return NULL;
+		q->tail = next;
+		tail = next;
+		next = atomic_load_explicit(&next->next, memory_order_acquire);
+	}
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+	if (tail != atomic_load_explicit(&q->head, memory_order_acquire))
+		return NULL;
+	queue_push(q, &q->stub);
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+/* }}} queue_pop */
+
+/* {{{ dlffi_Queue *queue_get(lua_State *L) */
+//	the queue is shared by all closures of the Lua state, its handle
+//	lives in the registry until the state is closed; the queue itself
+//	outlives the handle while closures refer to it
+static const char dlffi_queue_key = 0;
+dlffi_Queue *queue_get(lua_State *L)
+{
+	if (lua_checkstack(L, 2) == 0) return NULL;
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &dlffi_queue_key);
+	dlffi_Queue **h = luaL_testudata(L, -1, "dlffi_Queue");
+	lua_pop(L, 1);
+	if (h) return *h;
+	h = lua_newuserdata(L, sizeof(dlffi_Queue *));
+	if (!h) return NULL;
+	dlffi_Queue *q = *h = malloc(sizeof(dlffi_Queue));
+	if (!q) return NULL;
+	atomic_init(&q->stub.next, NULL);
+	atomic_init(&q->head, &q->stub);
+	q->tail = &q->stub;
+	atomic_init(&q->closed, 0);
+	atomic_init(&q->pushing, 0);
+	atomic_init(&q->refs, 1);
+	luaL_getmetatable(L, "dlffi_Queue");
+	lua_setmetatable(L, -2);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &dlffi_queue_key);
+	return q;
+}
+/* }}} queue_get */
+
+/* {{{ int closure_call(lua_State *L, dlffi_Function *o, void *ret, void **argv) */
+//	run the Lua function of the closure on the given Lua thread
+//	Return: LUA_OK, or error status with the message left on the stack
+//	when there is room for it
+static int closure_call(
+	lua_State *L,
+	dlffi_Function *o,
+	void *ret,
+	void **argv
+) {
+	int top = lua_gettop(L);
+	const char *e = NULL;
+	if (lua_checkstack(L, 2 + o->cif->nargs) == 0) return LUA_ERRMEM;
+	lua_rawgeti(L, LUA_REGISTRYINDEX, o->ref);
+	unsigned i = 0;
+	for (; i < o->cif->nargs; i++) {
+		if (! o->plan[i].push(L, argv[i])) {
+			e = "error occured processing arguments";
+			break;
+		};
+	}
+	int r = LUA_ERRRUN;
+	if (e == NULL) {
+		if (o->type == &ffi_type_void)
+			r = lua_pcall(L, o->cif->nargs, 0, 0);
+		else {
+			bzero(ret, o->type->size);
+			r = lua_pcall(L, o->cif->nargs, 1, 0);
+		}
+		// the error message is left at top + 1
+		if (r != LUA_OK) return r;
+		if ((o->type != &ffi_type_void) && (o->plan[o->cif->nargs].write(
+			L, -1, o->type, ret, o, NULL
+		) == NULL)) {
+			bzero(ret, o->type->size);
+			e = "error occured processing return value";
+			r = LUA_ERRRUN;
+		}
+	}
+	lua_settop(L, top);
+	if (e) lua_pushstring(L, e);
+	return r;
+}
+/* }}} closure_call */
+
+/* {{{ void closure_post(dlffi_Function *o, void **argv) */
+//	copy argument values, but not the memory they point to;
+//	the return value of the Lua function is discarded
+static void closure_post(dlffi_Function *o, void **argv)
+{
+	const size_t head = (sizeof(dlffi_Call) + 15) & ~(size_t)15;
+	const size_t frame = (o->frame_size + 15) & ~(size_t)15;
+	dlffi_Call *c = malloc(head + frame + o->type->size);
+	if (!c) return;
+	c->func = o;
+	c->done = NULL;
+	c->argv = (void **)((char *)c + head);
+	c->ret = (char *)c->argv + frame;
+	frame_layout(o, c->argv);
+	size_t i;
+	for (i = 0; i < o->argc; i++)
+		memcpy(c->argv[i], argv[i], o->types[i]->size);
+	atomic_fetch_add(&o->posted, 1);
+	if (queue_offer(o->queue, c)) return;
+	atomic_fetch_sub(&o->posted, 1);
+	free(c);
+}
+/* }}} closure_post */
+
+// {{{ void dlffi_closure_run(ffi_cif *, void *, void **, dlffi_Function *)
+static void dlffi_closure_run(
+	ffi_cif *cif,
+	void *ret,
+	void **argv,
+	dlffi_Function *o
+) {
+	(void)cif;
+	if ((o->mode == DLFFI_CLOSURE_DIRECT) ||
+		pthread_equal(pthread_self(), o->owner)) {
+		int top = lua_gettop(o->L);
+		closure_call(o->L, o, ret, argv);
+		lua_settop(o->L, top);
+		return;
+	}
+	if (o->mode == DLFFI_CLOSURE_POST) {
+		if (o->type != &ffi_type_void) bzero(ret, o->type->size);
+		closure_post(o, argv);
+		return;
+	}
+	if (o->type != &ffi_type_void) bzero(ret, o->type->size);
+	sem_t done;
+	if (sem_init(&done, 0, 0) != 0) return;
+	dlffi_Call c = {
+		.func = o,
+		.ret = ret,
+		.argv = argv,
+		.done = &done
+	};
+	if (queue_offer(o->queue, &c)) while (sem_wait(&done) != 0);
+	sem_destroy(&done);
+}
+// }}} dlffi_closure_run
+
+/* {{{ void call_finish(lua_State *L, dlffi_Call *c) */
+//	wake the caller waiting on the call, or free the posted call and
+//	unpin its closure once no posted calls are left
+static void call_finish(lua_State *L, dlffi_Call *c)
+{
+	if (c->done) {
+		sem_post(c->done);
+		return;
+	}
+	dlffi_Function *o = c->func;
+	free(c);
+	if ((atomic_fetch_sub(&o->posted, 1) == 1) &&
+		(o->pin != LUA_NOREF)) {
+		luaL_unref(L, LUA_REGISTRYINDEX, o->pin);
+		o->pin = LUA_NOREF;
+	}
+}
+/* }}} call_finish */
+
+/* {{{ lua_Integer queue_drain(lua_State *L, lua_Integer max) */
+//	run the closure calls queued by foreign threads on the given Lua thread
+//	Return: number of the calls run
+static lua_Integer queue_drain(lua_State *L, lua_Integer max)
+{
+	dlffi_Queue *q = queue_get(L);
+	if (!q) return 0;
+	lua_Integer n = 0;
+	int top = lua_gettop(L);
+	dlffi_Call *c;
+	while (((max <= 0) || (n < max)) && (c = queue_pop(q))) {
+		n++;
+		dlffi_Function *o = c->func;
+		closure_call(L, o, c->ret, c->argv);
+		lua_settop(L, top);
+		call_finish(L, c);
+	}
+	return n;
+}
+/* }}} queue_drain */
+
+/* {{{ n dlffi_poll([max]) */
+static int l_dlffi_poll(lua_State *L) {
+	lua_Integer n = queue_drain(L, luaL_optinteger(L, 1, 0));
+	lua_pushinteger(L, n);
+	return 1;
+}
+/* }}} dlffi_poll */
+
+/* {{{ void poll_hook(lua_State *L, lua_Debug *ar) */
+static void poll_hook(lua_State *L, lua_Debug *ar) {
+	(void)ar;
+	queue_drain(L, 0);
+}
+/* }}} poll_hook */
+
+/* {{{ void dlffi_poll_hook([count]) */
+//	drain the queue every count instructions of the calling Lua thread,
+//	without count the hook is removed; replaces any other debug hook
+static int l_dlffi_poll_hook(lua_State *L) {
+	lua_Integer count = luaL_optinteger(L, 1, 0);
+	if (count > 0) lua_sethook(L, poll_hook, LUA_MASKCOUNT, (int)count);
+	else lua_sethook(L, NULL, 0, 0);
+	return 0;
+}
+/* }}} dlffi_poll_hook */
+
+/* {{{ void dlffi_Queue_gc(dlffi_Queue) */
+//	the Lua state is closing: close the queue for late callers, release
+//	the waiting ones, their return values are zeroed before queueing,
+//	and drop the posted calls, so their closures can be collected
+static int dlffi_Queue_gc(lua_State *L) {
+	dlffi_Queue **h = luaL_checkudata(L, 1, "dlffi_Queue");
+	dlffi_Queue *q = *h;
+	if (!q) return 0;
+	*h = NULL;
+	atomic_store(&q->closed, 1);
+	while (atomic_load(&q->pushing)) sched_yield();
+	dlffi_Call *c;
+	while ((c = queue_pop(q))) call_finish(L, c);
+	queue_release(q);
+	return 0;
+}
+/* }}} dlffi_Queue_gc */
+
+/* {{{ dlffi_Function *l_dlffi_create(
+	void (*function)(),
+	ffi_type *rtype,
+	ffi_type **argument types
+	)
+*/
+static int l_dlffi_create(lua_State *L) {
+	size_t i;
+	if (lua_checkstack(L, 5) == 0) return 0;
+	dlffi_Function *o = (dlffi_Function *)
+		lua_newuserdata(L, sizeof(dlffi_Function));
+	if (!o) return 0;
+	o->types = NULL;
+	o->lib = NULL;
+	o->dlsym = NULL;
+	o->ret = NULL;
+	o->ref = LUA_REFNIL;
+	o->closure = NULL;
+	o->ref_table = LUA_REFNIL;
+	o->cast_field = NULL;
+	o->argc = 0;
+	o->argv = NULL;
+	o->frame_size = 0;
+	o->strbuf = NULL;
+	o->strbuf_size = 0;
+	o->busy = 0;
+	o->plan = NULL;
+	o->queue = NULL;
+	atomic_init(&o->posted, 0);
+	o->pin = LUA_NOREF;
+	o->name = NULL;
+	o->stats = NULL;
+	o->outs = NULL;
+	o->nouts = 0;
+	o->variadic = 0;
+	o->varcifs = NULL;
+	o->varuse = 0;
+	o->sig = NULL;
+	o->cif = NULL;
+	o->stub = NULL;
+	/* closure mode for the calls from foreign threads */
+	const char *modes[] = { "direct", "queue", "post", NULL };
+	o->mode = luaL_checkoption(L, 4, "direct", modes);
+	/* set the FFI type of a return value */
+	o->type = lua_touserdata(L, 2);
+	if (! o->type) {
+		lua_pushnil(L);
+		lua_pushstring(L,
+			"Incorrect return value FFI type specified");
+		return 2;
+	}
+	luaL_getmetatable(L, "dlffi_Function");
+	lua_setmetatable(L, -2);
+	/* iterate through argument FFI types */
+	luaL_checktype(L, 3, LUA_TTABLE);
+	size_t l = lua_objlen(L, 3);
+	o->types = calloc(l + 1, sizeof(ffi_type *));
+	if (! o->types) return 0;
+	o->types[l] = NULL;
+	for (i = 1; i <= l; i++) {
+		lua_pushinteger(L, (lua_Integer)i);
+		lua_gettable(L, 3);
+		o->types[i - 1] = lua_touserdata(L, -1);
+		if (! o->types[i-1]) {
+			lua_pushnil(L);
+			lua_pushfstring(L,
+				"Incorrect argment FFI type #%d",
+				(lua_Integer)i
+			);
+			return 2;
+		}
+		lua_pop(L, 1);
+	}
+	o->cif = malloc(sizeof(ffi_cif));
+	if (! o->cif) return 0;
+	ffi_status stat = ffi_prep_cif(
+		o->cif,
+		FFI_DEFAULT_ABI,
+		(unsigned int) l,
+		o->type,
+		o->types
+	);
+	if (stat != FFI_OK) {
+		lua_pushnil(L);
+		lua_pushstring(L, "ffi_prep_cif() failed");
+		return 2;
+	}
+	o->ret = malloc(o->type->size);
+	if (! o->ret) return 0;
+	o->argc = l;
+	o->frame_size = frame_layout(o, NULL);
+	o->argv = malloc(o->frame_size);
+	if (! o->argv) return 0;
+	frame_layout(o, o->argv);
+	o->plan = plan_compile(o);
+	if (! o->plan) return 0;
+	o->owner = pthread_self();
+	if (o->mode != DLFFI_CLOSURE_DIRECT) {
+		o->queue = queue_get(L);
+		if (! o->queue) return 0;
+		atomic_fetch_add(&o->queue->refs, 1);
+	}
+	o->closure = ffi_closure_alloc(sizeof(ffi_closure), &(o->dlsym));
+	lua_pushvalue(L, 1);
 	o->ref = luaL_ref(L, LUA_REGISTRYINDEX);
 	o->L = L;
 	ffi_prep_closure_loc(
 		o->closure,
-		&(o->cif),
+		o->cif,
 		(void (*)(ffi_cif *, void *, void **, void *))dlffi_closure_run,
 		o,
 		o->dlsym
 	);
 	return 1;
 }
-/* }}} l_dlffi_create */
+/* }}} l_dlffi_create */
+
+/* {{{ dlffi_Function *l_dlffi_load(
+	char *library,
+	char *function,
+	ffi_type *rtype | char *signature,
+	ffi_type **argument types | nil,
+	[ function ref_table | string field ],
+	[ table output arguments ]
+	)
+	a table argument is cast to C type by the ref_table function,
+	which is called with the dlffi_Function and the table, or is
+	taken from the given field of the table
+	output arguments are given by their indices, their types are
+	the pointed ones; the function then returns true, the return
+	value and the values of the output arguments
+*/
+static int l_dlffi_load(lua_State *L) {
+	size_t i;
+	if (lua_type(L, 1) == LUA_TFUNCTION) return l_dlffi_create(L);
+	const char *fun;
+	lua_settop(L, 6);
+	if (! lua_checkstack(L, 7)) return 0;
+	if (lua_type(L, 1) == LUA_TLIGHTUSERDATA) {
+		lua_pushstring(L, "");
+		lua_insert(L, 1);
+		fun = NULL;
+	} else {
+		fun = luaL_checkstring(L, 2);
+	}
+	const char *lib = luaL_checkstring(L, 1);
+	int ref_table;
+	const char *cast_field = NULL;
+	if (lua_type(L, 5) == LUA_TNIL) {
+		ref_table = LUA_REFNIL;
+	} else if (lua_type(L, 5) == LUA_TSTRING) {
+		// the referenced string stays in place
+		cast_field = lua_tostring(L, 5);
+		lua_pushvalue(L, 5);
+		ref_table = luaL_ref(L, LUA_REGISTRYINDEX);
+	} else {
+		lua_pushvalue(L, 5);
+		ref_table = luaL_ref(L, LUA_REGISTRYINDEX);
+	}
+	/* create dlffi_Function structure */
+	dlffi_Function *o = (dlffi_Function *)
+		lua_newuserdata(L, sizeof(dlffi_Function));
+	if (!o) return 0;
+	o->types = NULL;
+	o->lib = NULL;
+	o->dlsym = NULL;
+	o->ret = NULL;
+	o->ref = LUA_REFNIL;
+	o->ref_table = ref_table;
+	o->cast_field = cast_field;
+	o->argc = 0;
+	o->argv = NULL;
+	o->frame_size = 0;
+	o->strbuf = NULL;
+	o->strbuf_size = 0;
+	o->busy = 0;
+	o->plan = NULL;
+	o->mode = DLFFI_CLOSURE_DIRECT;
+	o->queue = NULL;
+	atomic_init(&o->posted, 0);
+	o->pin = LUA_NOREF;
+	o->name = NULL;
+	o->stats = NULL;
+	o->outs = NULL;
+	o->nouts = 0;
+	o->variadic = 0;
+	o->varcifs = NULL;
+	o->varuse = 0;
+	o->sig = NULL;
+	o->cif = NULL;
+	o->stub = NULL;
+	luaL_getmetatable(L, "dlffi_Function");
+	lua_setmetatable(L, -2);
+	char e[256];
+	o->lib = lib_open(lib, e, sizeof(e));
+	if (! o->lib) {
+		lua_pushnil(L);
+		lua_pushstring(L, e);
+		return 2;
+	}
+	if (fun) {
+		dlffi_Symbol *sym = lib_sym(o->lib, fun, e, sizeof(e));
+		if (! sym) {
+			lua_pushnil(L);
+			lua_pushstring(L, e);
+			return 2;
+		}
+		o->dlsym = sym->address;
+		o->name = sym->name;
+	} else {
+		o->dlsym = lua_touserdata(L, 2);
+	}
+	/* the interned signature gives all the types at once */
+	if (lua_type(L, 3) == LUA_TSTRING) {
+		if (lua_type(L, 6) != LUA_TNIL) {
+			lua_pushnil(L);
+			lua_pushstring(L, "output arguments are not supported "
+				"with a signature string");
+			return 2;
+		}
+		dlffi_Sig *sig = sig_get(lua_tostring(L, 3), e, sizeof(e));
+		if (! sig) {
+			lua_pushnil(L);
+			lua_pushstring(L, e);
+			return 2;
+		}
+		o->sig = sig;
+		o->cif = &(sig->cif);
+		o->stub = sig->stub;
+		o->type = sig->type;
+		o->types = sig->types;
+		o->argc = sig->argc;
+		o->variadic = sig->variadic;
+		o->plan = sig->plan;
+		if (o->type->size < sizeof(ffi_arg))
+			o->ret = malloc(sizeof(ffi_arg));
+		else o->ret = malloc(o->type->size);
+		if (! o->ret) return 0;
+		o->frame_size = frame_layout(o, NULL);
+		o->argv = malloc(o->frame_size);
+		if (! o->argv) return 0;
+		frame_layout(o, o->argv);
+		return 1;
+	}
+	/* set the FFI type of a return value */
+	o->type = lua_touserdata(L, 3);
+	if (! o->type) {
+		lua_pushnil(L);
+		lua_pushstring(L, "Incorrect return value FFI type specified");
+		return 2;
+	}
+	/* iterate through argument FFI types */
+	luaL_checktype(L, 4, LUA_TTABLE);
+	size_t l = lua_objlen(L, 4);
+	// "..." after the fixed arguments marks a variadic function
+	lua_rawgeti(L, 4, (lua_Integer)l);
+	if ( (l > 0) && (lua_type(L, -1) == LUA_TSTRING) &&
+		(strcmp(lua_tostring(L, -1), "...") == 0)
+	) {
+		o->variadic = 1;
+		l--;
+	}
+	lua_pop(L, 1);
+	o->types = calloc(l + 1, sizeof(ffi_type *));
+	if (! o->types) return 0;
+	o->types[l] = NULL;
+	for (i = 1; i <= l; i++) {
+		lua_pushinteger(L, (lua_Integer)i);
+		lua_gettable(L, 4);
+		o->types[i - 1] = lua_touserdata(L, -1);
+		if (! o->types[i-1]) {
+			lua_pushnil(L);
+			lua_pushfstring(L,
+				"Incorrect argment FFI type #%d",
+				(lua_Integer)i
+			);
+			return 2;
+		}
+		lua_pop(L, 1);
+	}
+	/* output arguments, the plan converts the pointed values */
+	o->argc = l;
+	if (lua_type(L, 6) != LUA_TNIL) {
+		luaL_checktype(L, 6, LUA_TTABLE);
+		if (o->variadic) {
+			lua_pushnil(L);
+			lua_pushstring(L, "output arguments of a variadic "
+				"function are not supported");
+			return 2;
+		}
+		o->nouts = lua_objlen(L, 6);
+		o->outs = malloc((o->nouts + 1) * sizeof(size_t));
+		if (! o->outs) return 0;
+	}
+	for (i = 0; i < o->nouts; i++) {
+		lua_rawgeti(L, 6, (lua_Integer)i + 1);
+		lua_Integer n = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		if ( (n < 1) || ((size_t)n > l) ) {
+			lua_pushnil(L);
+			lua_pushfstring(L,
+				"Output argument #%d does not exist",
+				(int)i + 1
+			);
+			return 2;
+		}
+		o->outs[i] = (size_t)n - 1;
+	}
+	o->plan = plan_compile(o);
+	if (! o->plan) return 0;
+	for (i = 0; i < o->nouts; i++) {
+		if (o->plan[o->outs[i]].out) {
+			lua_pushnil(L);
+			lua_pushfstring(L,
+				"Output argument #%d is given twice",
+				(int)i + 1
+			);
+			return 2;
+		}
+		o->plan[o->outs[i]].out = 1;
+		o->types[o->outs[i]] = &ffi_type_pointer;
+	}
+	o->cif = malloc(sizeof(ffi_cif));
+	if (! o->cif) return 0;
+	ffi_status stat = ffi_prep_cif(
+		o->cif,
+		FFI_DEFAULT_ABI,
+		l,
+		o->type,
+		o->types
+	);
+	if (stat != FFI_OK) {
+		lua_pushnil(L);
+		lua_pushstring(L, "ffi_prep_cif() failed");
+		return 2;
+	}
+	if (o->type->size < sizeof(ffi_arg))
+		o->ret = malloc(sizeof(ffi_arg));
+	else o->ret = malloc(o->type->size);
+	if (! o->ret) return 0;
+	/* prepare the call frame */
+	o->frame_size = frame_layout(o, NULL);
+	o->argv = malloc(o->frame_size);
+	if (! o->argv) return 0;
+	frame_layout(o, o->argv);
+	return 1;
+}
+/* }}} l_dlffi_load */
+
+/* {{{ struct dlffi_Stats */
+// counters of a function, times are in nanoseconds
+typedef struct dlffi_Stats {
+	struct dlffi_Stats *next;
+	struct dlffi_Stats **prev;
+	const char *name;
+	u_int64_t calls;
+	// time spent in ffi_call() or the Lua function of a closure
+	u_int64_t call_ns;
+	u_int64_t max_ns;
+	// time spent converting arguments and the return value
+	u_int64_t args_ns;
+	u_int64_t ret_ns;
+	// bytes of string arguments copied
+	u_int64_t strings;
+} dlffi_Stats;
+/* }}} struct dlffi_Stats */
+
+/* {{{ statistics of all the functions */
+static int dlffi_stats_on = 0;
+static dlffi_Stats *dlffi_stats = NULL;
+static pthread_mutex_t dlffi_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+/* }}} statistics of all the functions */
+
+/* {{{ dlffi_Stats *stats_get(dlffi_Function *o) */
+dlffi_Stats *stats_get(dlffi_Function *o)
+{
+	if (o->stats) return o->stats;
+	dlffi_Stats *st = calloc(1, sizeof(dlffi_Stats));
+	if (!st) return NULL;
+	st->name = o->name ? o->name :
+		((o->ref != LUA_REFNIL) ? "(closure)" : "(pointer)");
+	pthread_mutex_lock(&dlffi_stats_lock);
+	st->next = dlffi_stats;
+	if (st->next) st->next->prev = &(st->next);
+	st->prev = &dlffi_stats;
+	dlffi_stats = st;
+	pthread_mutex_unlock(&dlffi_stats_lock);
+	o->stats = st;
+	return st;
+}
+/* }}} stats_get */
+
+/* {{{ void stats_free(dlffi_Function *o) */
+void stats_free(dlffi_Function *o)
+{
+	dlffi_Stats *st = o->stats;
+	if (!st) return;
+	pthread_mutex_lock(&dlffi_stats_lock);
+	*(st->prev) = st->next;
+	if (st->next) st->next->prev = st->prev;
+	pthread_mutex_unlock(&dlffi_stats_lock);
+	free(st);
+	o->stats = NULL;
+}
+/* }}} stats_free */
+
+/* {{{ u_int64_t stats_clock(void) */
+static inline u_int64_t stats_clock(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (u_int64_t)t.tv_sec * 1000000000u + (u_int64_t)t.tv_nsec;
+}
+/* }}} stats_clock */
+
+/* {{{ table dlffi_stats([bool enable]) */
+//	enable or disable the counters, return a snapshot keyed by symbol name;
+//	functions of the same name are summed up, times are in seconds
+static int l_dlffi_stats(lua_State *L) {
+	if (lua_isboolean(L, 1)) dlffi_stats_on = lua_toboolean(L, 1);
+	if (lua_checkstack(L, 4) == 0) return 0;
+	lua_newtable(L);
+	pthread_mutex_lock(&dlffi_stats_lock);
+	dlffi_Stats *st;
+	for (st = dlffi_stats; st; st = st->next) {
+		if (st->calls == 0) continue;
+		if (lua_getfield(L, -1, st->name) != LUA_TTABLE) {
+			lua_pop(L, 1);
+			lua_createtable(L, 0, 6);
+			lua_pushvalue(L, -1);
+			lua_setfield(L, -3, st->name);
+		}
+		inline void add(const char *key, lua_Number v, int max) {
+			lua_getfield(L, -1, key);
+			lua_Number old = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+			if (max) lua_pushnumber(L, (v > old) ? v : old);
+			else lua_pushnumber(L, old + v);
+			lua_setfield(L, -2, key);
+		};
+		add("calls", (lua_Number)st->calls, 0);
+		add("time", (lua_Number)st->call_ns / 1e9, 0);
+		add("max", (lua_Number)st->max_ns / 1e9, 1);
+		add("args", (lua_Number)st->args_ns / 1e9, 0);
+		add("ret", (lua_Number)st->ret_ns / 1e9, 0);
+		add("strings", (lua_Number)st->strings, 0);
+		lua_pop(L, 1);
+	}
+	pthread_mutex_unlock(&dlffi_stats_lock);
+	return 1;
+}
+/* }}} dlffi_stats */
+
+/* {{{ void dlffi_stats_reset() */
+static int l_dlffi_stats_reset(lua_State *L) {
+	(void)L;
+	pthread_mutex_lock(&dlffi_stats_lock);
+	dlffi_Stats *st;
+	for (st = dlffi_stats; st; st = st->next) {
+		st->calls = 0;
+		st->call_ns = st->max_ns = 0;
+		st->args_ns = st->ret_ns = 0;
+		st->strings = 0;
+	}
+	pthread_mutex_unlock(&dlffi_stats_lock);
+	return 0;
+}
+/* }}} dlffi_stats_reset */
+
+/* {{{ dlffi_Function *dlffi_check_Function(lua_State *L)
+	check if the bottom value is of (dlffi_Function *)
+*/
+dlffi_Function *dlffi_check_Function(lua_State *L) {
+	return (dlffi_Function *)luaL_checkudata(L, 1, "dlffi_Function");
+}
+/* }}} dlffi_check_Function */
+
+/* {{{ ... dlffi_run(...)
+	arguments like in a loaded function
+*/
+/* {{{ variadic functions */
+/* {{{ void varcif_free(dlffi_Varcif *v) */
+static void varcif_free(dlffi_Varcif *v)
+{
+	free(v->types);
+	free(v->plan);
+	free(v->argv);
+	v->types = NULL;
+	v->plan = NULL;
+	v->argv = NULL;
+}
+/* }}} varcif_free */
+
+/* {{{ dlffi_Varcif *varcif_get(dlffi_Function *o, ffi_type **types, size_t argc) */
+//	find the call interface prepared for the given argument types,
+//	preparing it in place of the least recently used one on a miss
+//	Return: NULL on error
+static dlffi_Varcif *varcif_get(
+	dlffi_Function *o,
+	ffi_type **types,
+	size_t argc
+) {
+	size_t i;
+	if (! o->varcifs) {
+		o->varcifs = calloc(DLFFI_VARCIF, sizeof(dlffi_Varcif));
+		if (! o->varcifs) return NULL;
+	}
+	dlffi_Varcif *v, *lru = NULL;
+	for (v = o->varcifs; v < o->varcifs + DLFFI_VARCIF; v++) {
+		if ( v->types && (v->argc == argc) && (memcmp(
+			v->types, types, argc * sizeof(ffi_type *)
+		) == 0) ) {
+			v->used = ++(o->varuse);
+			return v;
+		}
+		if (v->busy) continue;
+		if ( (lru == NULL) || (v->types == NULL) ||
+			((lru->types != NULL) && (v->used < lru->used))
+		) lru = v;
+	}
+	// every entry is held by a nested call
+	if (lru == NULL) return NULL;
+	v = lru;
+	varcif_free(v);
+	v->types = malloc((argc + 1) * sizeof(ffi_type *));
+	if (! v->types) return NULL;
+	memcpy(v->types, types, argc * sizeof(ffi_type *));
+	v->types[argc] = NULL;
+	v->argc = argc;
+	if (ffi_prep_cif_var(&(v->cif), FFI_DEFAULT_ABI, o->argc, argc,
+		o->type, v->types) != FFI_OK
+	) {
+		varcif_free(v);
+		return NULL;
+	}
+	v->plan = malloc(argc * sizeof(dlffi_Op));
+	if (! v->plan) {
+		varcif_free(v);
+		return NULL;
+	}
+	for (i = 0; i < argc; i++) {
+		v->plan[i].type = types[i];
+		v->plan[i].push = type_pusher(types[i]);
+		v->plan[i].write = type_writer(types[i]);
+		v->plan[i].out = 0;
+	}
+	v->frame_size = frame_args(argc, v->types, NULL);
+	v->argv = malloc(v->frame_size);
+	if (! v->argv) {
+		varcif_free(v);
+		return NULL;
+	}
+	frame_args(argc, v->types, v->argv);
+	v->used = ++(o->varuse);
+	return v;
+}
+/* }}} varcif_get */
+
+/* {{{ ffi_type *vararg_type(lua_State *L, int idx) */
+//	infer FFI type of a variadic argument after default promotions
+static ffi_type *vararg_type(lua_State *L, int idx)
+{
+	switch (lua_type(L, idx)) {
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, idx)) return &ffi_type_slong;
+		return &ffi_type_double;
+	case LUA_TBOOLEAN:
+		return &ffi_type_sint;
+	default:
+		return &ffi_type_pointer;
+	}
+}
+/* }}} vararg_type */
+
+/* {{{ int dlffi_vrun(lua_State *L, dlffi_Function *o, int base, int decl) */
+//	call the variadic function with the arguments from base on,
+//	types of the variadic ones are taken from the table at decl,
+//	if any, or are inferred from the values
+static int dlffi_vrun(lua_State *L, dlffi_Function *o, int base, int decl)
+{
+	size_t fixed = o->argc, i;
+	inline int report(const char *msg) {
+		if ( lua_checkstack(L, 2) == 0 ) return 0;
+		lua_pushnil(L);
+		lua_pushstring(L, msg);
+		return 2;
+	};
+	if (lua_gettop(L) - base + 1 < (int)fixed) {
+		if ( lua_checkstack(L, 2) == 0 ) return 0;
+		lua_pushnil(L);
+		lua_pushfstring(L, "passed %d arguments, but %d expected",
+			lua_gettop(L) - base, (int)fixed);
+		return 2;
+	}
+	size_t argc = lua_gettop(L) - base + 1;
+	if ( decl && (lua_rawlen(L, decl) != argc - fixed) ) {
+		if ( lua_checkstack(L, 2) == 0 ) return 0;
+		lua_pushnil(L);
+		lua_pushfstring(L, "passed %d variadic arguments, but %d declared",
+			(int)(argc - fixed), (int)lua_rawlen(L, decl));
+		return 2;
+	}
+	ffi_type *types[argc + 1];
+	memcpy(types, o->types, fixed * sizeof(ffi_type *));
+	for (i = fixed; i < argc; i++) {
+		if (decl == 0) {
+			types[i] = vararg_type(L, base + i);
+			continue;
+		}
+		int n = (int)(i - fixed + 1);
+		if (lua_rawgeti(L, decl, n) != LUA_TLIGHTUSERDATA)
+			return luaL_argerror(L, decl, lua_pushfstring(L,
+				"FFI type expected for variadic argument #%d", n));
+		types[i] = lua_touserdata(L, -1);
+		lua_pop(L, 1);
+		const char *e = NULL;
+		if (! types[i]) e = "Incorrect variadic argument FFI type #%d";
+		else switch (types[i]->type) {
+		// C promotes them to int and double, see vararg_type()
+		case FFI_TYPE_FLOAT:
+		case FFI_TYPE_UINT8:
+		case FFI_TYPE_SINT8:
+		case FFI_TYPE_UINT16:
+		case FFI_TYPE_SINT16:
+			e = "variadic argument #%d of float, char or short type "
+				"is passed promoted, declare double or int";
+		}
+		if (e) {
+			if ( lua_checkstack(L, 2) == 0 ) return 0;
+			lua_pushnil(L);
+			lua_pushfstring(L, e, n);
+			return 2;
+		}
+	}
+	dlffi_Varcif *v = varcif_get(o, types, argc);
+	if (! v) return report("ffi_prep_cif_var() failed");
+	size_t strsize = 0;
+	for (i = 0; i < argc; i++) {
+		if (lua_type(L, base + i) == LUA_TSTRING)
+			strsize += lua_rawlen(L, base + i) + 1;
+	}
+	// a nested call lays out its frame as frame_acquire() does
+	dlffi_Scratch scratch;
+	void **argv;
+	int nested = o->busy;
+	scratch.spill = NULL;
+	scratch.borrow = 1;
+	scratch.arena = NULL;
+	if (nested) {
+		if ( lua_checkstack(L, 1) == 0 ) return 0;
+		argv = lua_newuserdata(L, v->frame_size + strsize);
+		if (!argv) return 0;
+		frame_args(argc, v->types, argv);
+		scratch.buf = (char *)argv + v->frame_size;
+		scratch.left = strsize;
+	} else {
+		if (! strbuf_reserve(o, &scratch, strsize)) return 0;
+		argv = v->argv;
+		o->busy = 1;
+		frame_guard(L);
+	}
+	v->busy++;
+	dlffi_Op *op = v->plan;
+	for (i = 0; i < argc; i++, op++) {
+		void *u = op->write(
+			L, base + i, op->type, argv[i], o, &scratch
+		);
+		if (u == NULL) break;
+	}
+	if (i == argc) ffi_call(&(v->cif), o->dlsym, (void *)o->ret, argv);
+	scratch_free(&scratch);
+	v->busy--;
+	if (! nested) frame_release(o);
+	if (i != argc) return report("error occured processing arguments");
+	if (o->type == &ffi_type_void) return 0;
+	if (lua_checkstack(L, 1) == 0) return 0;
+	return o->plan[fixed].push(L, o->ret);
+}
+/* }}} dlffi_vrun */
+
+/* {{{ dlffi_Function:vcall(types, ...)
+	call the variadic function with the declared types of the
+	variadic arguments, one per argument
+*/
+static int l_dlffi_vcall(lua_State *L) {
+	dlffi_Function *o = dlffi_check_Function(L);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	if ( (o->types == NULL) || (o->ret == NULL) || (! o->variadic) ) {
+		if ( lua_checkstack(L, 2) == 0 ) return 0;
+		lua_pushnil(L);
+		lua_pushstring(L, "function is not a loaded variadic one");
+		return 2;
+	}
+	return dlffi_vrun(L, o, 3, 2);
+}
+/* }}} dlffi_vcall */
+/* }}} variadic functions */
+
+/* {{{ void *out_write(...) */
+//	point the output argument to its buffer in the call frame:
+//	nil leaves the pointer NULL, dl.NULL zeroes the buffer,
+//	any other value initializes it
+//	Return: the argument pointer or NULL on error
+static void *out_write(
+	lua_State *L,
+	int idx,
+	dlffi_Op *op,
+	void **argv,
+	size_t i,
+	dlffi_Function *o,
+	dlffi_Scratch *scratch
+) {
+	void *buf = (char *)argv + op->out;
+	switch (lua_type(L, idx)) {
+	case LUA_TNONE:
+	case LUA_TNIL:
+		buf = NULL;
+		break;
+	case LUA_TBOOLEAN:
+		if (lua_toboolean(L, idx)) return NULL;
+		buf = NULL;
+		break;
+	case LUA_TLIGHTUSERDATA:
+		if (lua_touserdata(L, idx) == NULL) {
+			memset(buf, 0, op->type->size);
+			break;
+		}
+		[[fallthrough]];
+	default:
+		if (! op->write(L, idx, op->type, buf, o, scratch))
+			return NULL;
+	}
+	*(void **)argv[i] = buf;
+	return argv[i];
+}
+/* }}} out_write */
 
-/* {{{ dlffi_Function *l_dlffi_load(
-	char *library,
-	char *function,
-	ffi_type *rtype,
-	ffi_type **argument types,
-	[ function ref_table ]
-	)
-*/
-static int l_dlffi_load(lua_State *L) {
+/* {{{ int out_push(lua_State *L, dlffi_Function *o, void **argv) */
+//	push true, the return value and the values of output arguments
+static int out_push(lua_State *L, dlffi_Function *o, void **argv)
+{
+	if (lua_checkstack(L, o->nouts + 2) == 0) return 0;
+	lua_pushboolean(L, 1);
+	if (o->type == &ffi_type_void) lua_pushnil(L);
+	else o->plan[o->argc].push(L, o->ret);
 	size_t i;
-	if (lua_type(L, 1) == LUA_TFUNCTION) return l_dlffi_create(L);
-	const char *fun;
-	lua_settop(L, 5);
-	if (! lua_checkstack(L, 7)) return 0;
-	if (lua_type(L, 1) == LUA_TLIGHTUSERDATA) {
-		lua_pushstring(L, "");
-		lua_insert(L, 1);
-		fun = NULL;
-	} else {
-		fun = luaL_checkstring(L, 2);
-	}
-	const char *lib = luaL_checkstring(L, 1);
-	int ref_table;
-	if (lua_type(L, 5) == LUA_TNIL) {
-		ref_table = LUA_REFNIL;
-	} else {
-		lua_pushvalue(L, 5);
-		ref_table = luaL_ref(L, LUA_REGISTRYINDEX);
+	for (i = 0; i < o->nouts; i++) {
+		dlffi_Op *op = &(o->plan[o->outs[i]]);
+		if (*(void **)argv[o->outs[i]] == NULL)
+			lua_pushlightuserdata(L, NULL);
+		else op->push(L, (char *)argv + op->out);
 	}
-	/* create dlffi_Function structure */
-	dlffi_Function *o = (dlffi_Function *)
-		lua_newuserdata(L, sizeof(dlffi_Function));
-	if (!o) return 0;
-	o->types = NULL;
-	o->dlhdl = NULL;
-	o->dlsym = NULL;
-	o->ret = NULL;
-	o->ref = LUA_REFNIL;
-	o->ref_table = ref_table;
-	luaL_getmetatable(L, "dlffi_Function");
-	lua_setmetatable(L, -2);
-	if (*lib == 0) {
-		o->dlhdl = dlopen(NULL, RTLD_LAZY);
-	} else o->dlhdl = dlopen(lib, RTLD_LAZY);
-	if (! o->dlhdl) {
+	return o->nouts + 2;
+}
+/* }}} out_push */
+
+static int dlffi_run(lua_State *L) {
+	dlffi_Function *o = dlffi_check_Function(L);
+	size_t argc, i;
+	inline int report(const char *msg) {
+		if ( lua_checkstack(L, 2) == 0 ) return 0;
+		lua_pushnil(L);
+		lua_pushstring(L, msg);
+		return 2;
+	};
+	if ( (o->types == NULL) || (o->ret == NULL) )
+		return report("function must be loaded first");
+	if (o->variadic) return dlffi_vrun(L, o, 2, 0);
+	argc = o->argc;
+	// trailing output arguments may be omitted
+	for (i = lua_gettop(L) - 1; i < argc; i++)
+		if (! o->plan[i].out) break;
+	if ( (i != argc) || ((size_t)(lua_gettop(L) - 1) > argc) ) {
+		if ( lua_checkstack(L, 2) == 0 ) return 0;
 		lua_pushnil(L);
-		lua_pushfstring(L, "dlopen() failed: %s", dlerror());
+		lua_pushfstring(L, "passed %d arguments, but %d expected",
+			lua_gettop(L) - 2, (int)argc);
 		return 2;
 	}
-	dlerror();
-	if (fun) {
-		o->dlsym = dlsym(o->dlhdl, fun);
-	} else {
-		o->dlsym = lua_touserdata(L, 2);
+	// room for copies of string arguments, ffi_type_cstring borrows them
+	size_t strsize = 0;
+	for (i = 0; i < argc; i++) {
+		if ((lua_type(L, i + 2) == LUA_TSTRING) &&
+			(o->plan[i].type != &dlffi_type_cstring))
+			strsize += lua_rawlen(L, i + 2) + 1;
+	}
+	// counters cost a single branch while disabled
+	dlffi_Stats *st = dlffi_stats_on ? stats_get(o) : NULL;
+	u_int64_t t0 = 0, t1 = 0, t2 = 0;
+	if (st) t0 = stats_clock();
+	dlffi_Scratch scratch;
+	int nested = o->busy;
+	void **argv = frame_acquire(L, o, strsize, &scratch);
+	if (!argv) return 0;
+	dlffi_Op *op = o->plan;
+	for (i = 0; i < argc; i++, op++) {
+		void *u = op->out ?
+			out_write(L, i + 2, op, argv, i, o, &scratch) :
+			op->write(L, i + 2, op->type, argv[i], o, &scratch);
+		if (u == NULL) break;
 	}
-	char *e;
-	if ((e = dlerror()) != NULL) {
+	int top = lua_gettop(L), r = LUA_OK;
+	if (st) t1 = stats_clock();
+	if (i == argc) {
+		// closure: the Lua function sees the arguments as C would pass
+		if (o->ref != LUA_REFNIL) r = closure_call(L, o, o->ret, argv);
+		else func_call(o, o->ret, argv);
+	}
+	if (st) t2 = stats_clock();
+	// bytes copied to the string buffer, borrowed strings take none
+	size_t copied = strsize - scratch.left;
+	scratch_free(&scratch);
+	if (! nested) frame_release(o);
+	if (i != argc) return report("error occured processing arguments");
+	if (r != LUA_OK) {
+		if (lua_gettop(L) == top) return report("closure call failed");
 		lua_pushnil(L);
-		lua_pushfstring(L, "dlsym() failed: %s", e);
+		lua_insert(L, -2);
 		return 2;
 	}
-	/* set the FFI type of a return value */
-	o->type = lua_touserdata(L, 3);
-	if (! o->type) {
+	if (st) {
+		// dl.stats() may read the counters from another Lua state
+		pthread_mutex_lock(&dlffi_stats_lock);
+		st->calls++;
+		st->args_ns += t1 - t0;
+		st->call_ns += t2 - t1;
+		if (t2 - t1 > st->max_ns) st->max_ns = t2 - t1;
+		st->strings += copied;
+		pthread_mutex_unlock(&dlffi_stats_lock);
+	}
+	if (o->nouts) return out_push(L, o, argv);
+	if (o->type == &ffi_type_void) return 0;
+	if (lua_checkstack(L, 1) == 0) return 0;
+	if (!st) return op->push(L, o->ret);
+	r = op->push(L, o->ret);
+	u_int64_t t3 = stats_clock();
+	pthread_mutex_lock(&dlffi_stats_lock);
+	st->ret_ns += t3 - t2;
+	pthread_mutex_unlock(&dlffi_stats_lock);
+	return r;
+}
+/* }}} dlffi_run */
+
+/* {{{ char *column_base(lua_State *L, int idx) */
+//	first element of the buffer column at idx, see dlffi_batch()
+static char *column_base(lua_State *L, int idx)
+{
+	dlffi_View *v = luaL_testudata(L, idx, "dlffi_View");
+	if (v) return v->owner ? v->owner->pointer : v->pointer;
+	return ((dlffi_Pointer *)lua_touserdata(L, idx))->pointer;
+}
+/* }}} column_base */
+
+/* {{{ int dlffi_batch(...) */
+//	call the function once per row with a single frame and plan
+//	o	- loaded function
+//	n	- number of rows
+//	out	- packed buffer for the return values or NULL for a table
+//	base	- stack index of the first argument column:
+//		Lua array	- i-th row takes the i-th element
+//		dlffi_Pointer of known length or dlffi_View - packed
+//				array of the argument's C type
+//		anything else	- the same value for every row
+//	Return: number of values pushed onto the stack
+static int dlffi_batch(
+	lua_State *L,
+	dlffi_Function *o,
+	size_t n,
+	void *out,
+	int base
+) {
+	enum { COL_CONST, COL_TABLE, COL_BUFFER };
+	size_t argc = o->argc;
+	size_t i, row;
+	inline int report(const char *msg) {
+		if ( lua_checkstack(L, 2) == 0 ) return 0;
 		lua_pushnil(L);
-		lua_pushstring(L, "Incorrect return value FFI type specified");
+		lua_pushstring(L, msg);
+		return 2;
+	};
+	if ( (o->types == NULL) || (o->ret == NULL) )
+		return report("function must be loaded first");
+	if (o->nouts)
+		return report("output arguments are not supported");
+	if (o->variadic)
+		return report("variadic functions are not supported");
+	if (argc != (size_t)(lua_gettop(L) - base + 1)) {
+		if ( lua_checkstack(L, 2) == 0 ) return 0;
+		lua_pushnil(L);
+		lua_pushfstring(L, "passed %d columns, but %d expected",
+			lua_gettop(L) - base, argc);
 		return 2;
 	}
-	/* iterate through argument FFI types */
-	luaL_checktype(L, 4, LUA_TTABLE);
-	size_t l = lua_objlen(L, 4);
-	o->types = calloc(l + 1, sizeof(ffi_type *));
-	if (! o->types) return 0;
-	o->types[l] = NULL;
-	for (i = 1; i <= l; i++) {
-		lua_pushinteger(L, (lua_Integer)i);
-		lua_gettable(L, 4);
-		o->types[i - 1] = lua_touserdata(L, -1);
-		if (! o->types[i-1]) {
-			lua_pushnil(L);
-			lua_pushfstring(L,
-				"Incorrect argment FFI type #%d",
-				(lua_Integer)i
+	if ( lua_checkstack(L, argc + 4) == 0 ) return 0;
+	int *kind = lua_newuserdata(L, (argc + 1) * sizeof(int));
+	if (!kind) return 0;
+	int results = 0;
+	if (out == NULL && o->type != &ffi_type_void) {
+		lua_createtable(L, (int)n, 0);
+		results = lua_gettop(L);
+	}
+	// constant values are written once, their strings are spilled
+	dlffi_Scratch constant = { NULL, 0, NULL, 1, NULL };
+	dlffi_Scratch scratch;
+	int nested = o->busy;
+	void **argv = frame_acquire(L, o, 0, &scratch);
+	if (!argv) return 0;
+	int top = lua_gettop(L);
+	dlffi_Op *op = o->plan;
+	const char *e = NULL;
+	const char *where = "column";
+	for (i = 0; i < argc; i++) {
+		int col = base + i;
+		switch (lua_type(L, col)) {
+		case LUA_TTABLE:
+			kind[i] = COL_TABLE;
+			if (lua_rawlen(L, col) < n)
+				e = "column is shorter than the number of rows";
+			break;
+		case LUA_TUSERDATA: {
+			size_t size = op[i].type->size;
+			dlffi_Pointer *p = luaL_testudata(L, col, "dlffi_Pointer");
+			dlffi_View *v = luaL_testudata(L, col, "dlffi_View");
+			if (p) {
+				kind[i] = COL_BUFFER;
+				if (p->size / size >= n) break;
+				e = p->size ?
+					"buffer column is shorter than the number of rows" :
+					"buffer column of unknown length, pass a dlffi_View";
+				break;
+			}
+			if (v) {
+				kind[i] = COL_BUFFER;
+				if (v->type->size != size)
+					e = "element size of the view differs from the argument";
+				else if (v->n < n)
+					e = "buffer column is shorter than the number of rows";
+				else if (column_base(L, col) == NULL)
+					e = "memory of the view is released";
+				break;
+			}
+			}
+			[[fallthrough]];
+		default:
+			kind[i] = COL_CONST;
+			if (op[i].write(
+				L, col, op[i].type, argv[i], o, &constant
+			) == NULL) e = "error occured processing arguments";
+		}
+		if (e) break;
+	}
+	if (e == NULL) where = "row";
+	for (row = 0; (e == NULL) && (row < n); row++) {
+		// fetch the row, reserving room for its strings
+		size_t strsize = 0;
+		for (i = 0; i < argc; i++) {
+			if (kind[i] != COL_TABLE) continue;
+			if (lua_rawgeti(L, base + i, row + 1) == LUA_TSTRING)
+				strsize += lua_rawlen(L, -1) + 1;
+		}
+		if (! nested) {
+			if (! strbuf_reserve(o, &scratch, strsize)) {
+				e = "memory allocation error";
+				break;
+			}
+		}
+		int idx = top;
+		for (i = 0; i < argc; i++) {
+			if (kind[i] == COL_TABLE) {
+				if (op[i].write(
+					L, ++idx, op[i].type, argv[i],
+					o, &scratch
+				) == NULL) break;
+			} else if (kind[i] == COL_BUFFER) {
+				size_t size = op[i].type->size;
+				memcpy(
+					argv[i],
+					column_base(L, base + i) + size * row,
+					size
+				);
+			}
+		}
+		lua_settop(L, top);
+		if (i != argc) {
+			e = "error occured processing arguments";
+			break;
+		}
+		if (o->ref == LUA_REFNIL)
+			func_call(o, o->ret, argv);
+		else if (closure_call(L, o, o->ret, argv) != LUA_OK) {
+			lua_settop(L, top);
+			e = "closure call failed";
+			break;
+		}
+		scratch_free(&scratch);
+		if (out) {
+			memcpy(
+				(char *)out + o->type->size * row,
+				o->ret,
+				o->type->size
 			);
-			return 2;
+		} else if (results) {
+			if (! op[argc].push(L, o->ret)) {
+				e = "error occured processing return value";
+				break;
+			}
+			if (op[argc].push == push_struct) {
+				// o->ret is reused by the next row, own a copy
+				dlffi_Pointer *p = lua_touserdata(L, -1);
+				if ((p->pointer = malloc(o->type->size)) == NULL) {
+					lua_pop(L, 1);
+					e = "memory allocation error";
+					break;
+				}
+				memcpy(p->pointer, o->ret, o->type->size);
+				p->gc = 1;
+				p->size = o->type->size;
+			}
+			lua_rawseti(L, results, row + 1);
 		}
-		lua_pop(L, 1);
 	}
-	ffi_status stat = ffi_prep_cif(
-		&o->cif,
-		FFI_DEFAULT_ABI,
-		l,
-		o->type,
-		o->types
-	);
-	if (stat != FFI_OK) {
+	scratch_free(&scratch);
+	scratch_free(&constant);
+	if (! nested) frame_release(o);
+	if (e) {
+		if ( lua_checkstack(L, 2) == 0 ) return 0;
 		lua_pushnil(L);
-		lua_pushstring(L, "ffi_prep_cif() failed");
+		lua_pushfstring(L, "%s (%s #%d)", e, where,
+			(int)((*where == 'r') ? row : i) + 1);
 		return 2;
 	}
-	if (o->type->size < sizeof(ffi_arg))
-		o->ret = malloc(sizeof(ffi_arg));
-	else o->ret = malloc(o->type->size);
-	if (! o->ret) return 0;
+	if (results) {
+		lua_pushvalue(L, results);
+	} else lua_pushinteger(L, (lua_Integer)n);
 	return 1;
 }
-/* }}} l_dlffi_load */
+/* }}} dlffi_batch */
 
-/* {{{ dlffi_Function *dlffi_check_Function(lua_State *L)
-	check if the bottom value is of (dlffi_Function *)
+/* {{{ ... dlffi_batch(dlffi_Function, n, out, ...)
+	call the function n times, see dlffi_batch()
 */
-dlffi_Function *dlffi_check_Function(lua_State *L) {
-	return (dlffi_Function *)luaL_checkudata(L, 1, "dlffi_Function");
+static int l_dlffi_batch(lua_State *L) {
+	dlffi_Function *o = dlffi_check_Function(L);
+	lua_Integer n = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, n >= 0, 2, "negative number of rows");
+	void *out = NULL;
+	switch (lua_type(L, 3)) {
+	case LUA_TNIL:
+		break;
+	case LUA_TLIGHTUSERDATA:
+		out = lua_touserdata(L, 3);
+		break;
+	default: {
+		dlffi_Pointer *p = dlffi_check_Pointer(L, 3);
+		luaL_argcheck(L, ! pointer_readonly(p), 3, "read-only mapping");
+		luaL_argcheck(L, (p->size == 0) || (o->type == NULL) ||
+			(p->size / o->type->size >= (size_t)n), 3,
+			"output buffer is shorter than the number of rows");
+		out = p->pointer;
+		}
+	}
+	return dlffi_batch(L, o, (size_t)n, out, 4);
 }
-/* }}} dlffi_check_Function */
+/* }}} dlffi_batch */
 
-/* {{{ ... dlffi_run(...)
-	arguments like in a loaded function
+/* {{{ table dlffi_Function:map(...)
+	call the function for each row of the given Lua arrays
 */
-static int dlffi_run(lua_State *L) {
+static int l_dlffi_map(lua_State *L) {
+	dlffi_Function *o = dlffi_check_Function(L);
+	int i, top = lua_gettop(L);
+	// the first array defines the number of rows
+	for (i = 2; i <= top; i++) {
+		if (lua_type(L, i) == LUA_TTABLE) break;
+	}
+	if (i > top) {
+		if ( lua_checkstack(L, 2) == 0 ) return 0;
+		lua_pushnil(L);
+		lua_pushstring(L, "no Lua array among the arguments");
+		return 2;
+	}
+	return dlffi_batch(L, o, lua_rawlen(L, i), NULL, 2);
+}
+/* }}} dlffi_map */
+
+/* {{{ struct dlffi_Future */
+// foreign function call running on a worker thread
+typedef struct dlffi_Future {
+	// next call in the queue of the worker pool
+	struct dlffi_Future *next;
+	dlffi_Function *func;
+	// call frame, copies of strings and the return value follow the future
+	void **argv;
+	void *ret;
+	// strings of cast tables, which did not fit, see dlffi_Scratch
+	void *spill;
+	_Atomic int ready;
+	// posted by the worker once the call is finished
+	sem_t done;
+	// the owner has consumed the semaphore
+	int waited;
+} dlffi_Future;
+/* }}} struct dlffi_Future */
+
+/* {{{ worker pool */
+static pthread_mutex_t dlffi_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dlffi_pool_cond = PTHREAD_COND_INITIALIZER;
+static dlffi_Future *dlffi_pool_head = NULL;
+static dlffi_Future *dlffi_pool_tail = NULL;
+static size_t dlffi_pool_size = 0;
+/* }}} worker pool */
+
+/* {{{ void *pool_worker(void *arg) */
+static void *pool_worker(void *arg)
+{
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&dlffi_pool_lock);
+		while (dlffi_pool_head == NULL)
+			pthread_cond_wait(&dlffi_pool_cond, &dlffi_pool_lock);
+		dlffi_Future *f = dlffi_pool_head;
+		dlffi_pool_head = f->next;
+		if (dlffi_pool_head == NULL) dlffi_pool_tail = NULL;
+		pthread_mutex_unlock(&dlffi_pool_lock);
+		func_call(f->func, f->ret, f->argv);
+		atomic_store_explicit(&f->ready, 1, memory_order_release);
+		sem_post(&f->done);
+	}
+	return NULL;
+}
+/* }}} pool_worker */
+
+/* {{{ size_t pool_grow(size_t size) */
+//	workers are never stopped, the library is linked with -z nodelete
+//	Return: number of workers
+static size_t pool_grow(size_t size)
+{
+	pthread_mutex_lock(&dlffi_pool_lock);
+	while (dlffi_pool_size < size) {
+		pthread_t t;
+		if (pthread_create(&t, NULL, pool_worker, NULL) != 0) break;
+		pthread_detach(t);
+		dlffi_pool_size++;
+	}
+	size = dlffi_pool_size;
+	pthread_mutex_unlock(&dlffi_pool_lock);
+	return size;
+}
+/* }}} pool_grow */
+
+/* {{{ int pool_submit(dlffi_Future *f) */
+static int pool_submit(dlffi_Future *f)
+{
+	if ((dlffi_pool_size == 0) && (pool_grow(4) == 0)) return 0;
+	f->next = NULL;
+	pthread_mutex_lock(&dlffi_pool_lock);
+	if (dlffi_pool_tail) dlffi_pool_tail->next = f;
+	else dlffi_pool_head = f;
+	dlffi_pool_tail = f;
+	pthread_cond_signal(&dlffi_pool_cond);
+	pthread_mutex_unlock(&dlffi_pool_lock);
+	return 1;
+}
+/* }}} pool_submit */
+
+/* {{{ n dlffi_async_workers([n]) */
+//	start more workers, the pool never shrinks
+static int l_dlffi_async_workers(lua_State *L) {
+	lua_Integer n = luaL_optinteger(L, 1, 0);
+	lua_pushinteger(L, (lua_Integer)pool_grow(n > 0 ? (size_t)n : 0));
+	return 1;
+}
+/* }}} dlffi_async_workers */
+
+/* {{{ dlffi_Future dlffi_Function:async(...) */
+//	arguments are converted on the calling thread, the future keeps
+//	the function and the arguments alive; Return: future or nil,
+//	error message
+static int l_dlffi_async(lua_State *L) {
 	dlffi_Function *o = dlffi_check_Function(L);
-	size_t argc = 0;
+	size_t argc = o->argc, i;
 	inline int report(const char *msg) {
 		if ( lua_checkstack(L, 2) == 0 ) return 0;
 		lua_pushnil(L);
@@ -617,60 +3244,158 @@ static int dlffi_run(lua_State *L) {
 		return report("function must be loaded first");
 	if (o->ref != LUA_REFNIL)
 		return report("closure function call not implemented");
-	while (o->types[argc]) argc += 1;
+	if (o->nouts)
+		return report("output arguments are not supported");
+	if (o->variadic)
+		return report("variadic functions are not supported");
 	if (argc != (size_t)(lua_gettop(L) - 1)) {
 		if ( lua_checkstack(L, 2) == 0 ) return 0;
 		lua_pushnil(L);
 		lua_pushfstring(L, "passed %d arguments, but %d expected",
-			lua_gettop(L) - 2, argc);
+			lua_gettop(L) - 2, (int)argc);
 		return 2;
 	}
-	void **argv = calloc(argc + 1, sizeof(void *));
-	if (!argv) return 0;
-	argv[argc] = NULL;
-	inline int raise_error(lua_State *L,
-		const char *e,
-		size_t argc,
-		void **argv
-	) {
-		if (argv) while (argv[++argc]) {
-			if (lua_type(L, argc + 2) == LUA_TSTRING)
-				free(*(char **)(argv[argc]));
-			free(argv[argc]);
-		}
-		if (!e) return 0;
-		if ( lua_checkstack(L, 2) == 0 ) return 0;
-		lua_pushnil(L);
-		lua_pushfstring(L, e);
-		return 2;
+	size_t strsize = 0;
+	for (i = 0; i < argc; i++) {
+		if (lua_type(L, i + 2) == LUA_TSTRING)
+			strsize += lua_rawlen(L, i + 2) + 1;
 	}
-	if (argc) do {
-		argc -= 1;
-		argv[argc] = malloc(o->types[argc]->size);
-		if (!argv[argc]) return raise_error(L, NULL, argc, argv);
-		void *u = type_write(
-			L, argc + 2, o->types[argc], argv[argc], o
-		);
-		if (u == NULL) {
-			free(argv[argc]);
-			return raise_error(
-				L,
-				"error occured processing arguments",
-				argc, argv
-			);
-		}
-	} while(argc);
-	ffi_call(&(o->cif), o->dlsym, (void *)o->ret, argv);
-	while (argv[argc]) {
-		if (lua_type(L, argc + 2) == LUA_TSTRING)
-			free(*(char **)(argv[argc]));
-		free(argv[argc++]);
+	const size_t align = 16;
+	size_t head = (sizeof(dlffi_Future) + align - 1) & ~(align - 1);
+	size_t frame = (o->frame_size + align - 1) & ~(align - 1);
+	size_t ret = o->type->size;
+	if (ret < sizeof(ffi_arg)) ret = sizeof(ffi_arg);
+	if ( lua_checkstack(L, 4) == 0 ) return 0;
+	dlffi_Future *f = lua_newuserdata(L, head + frame + ret + strsize);
+	if (!f) return 0;
+	f->func = o;
+	f->argv = (void **)((char *)f + head);
+	f->ret = (char *)f->argv + frame;
+	f->spill = NULL;
+	atomic_init(&f->ready, 0);
+	f->waited = 1;
+	frame_layout(o, f->argv);
+	dlffi_Scratch scratch = {
+		.buf = (char *)f->ret + ret,
+		.left = strsize,
+		.spill = NULL
 	};
-	free(argv);
-	if (o->type == &ffi_type_void) return 0;
-	return type_push(L, o->ret, o->type);
+	dlffi_Op *op = o->plan;
+	for (i = 0; i < argc; i++, op++) {
+		if (op->write(L, i + 2, op->type, f->argv[i], o, &scratch)
+			== NULL) break;
+	}
+	// direct strings fit the reserved room, strings of cast tables
+	// are spilled and freed once the call is finished
+	if (i != argc) {
+		scratch_free(&scratch);
+		return report("error occured processing arguments");
+	}
+	if (sem_init(&(f->done), 0, 0) != 0) {
+		scratch_free(&scratch);
+		return report("sem_init() failed");
+	}
+	f->spill = scratch.spill;
+	f->waited = 0;
+	luaL_getmetatable(L, "dlffi_Future");
+	lua_setmetatable(L, -2);
+	// the function and the arguments, the memory of pointers included
+	lua_createtable(L, (int)argc + 1, 0);
+	for (i = 0; i <= argc; i++) {
+		lua_pushvalue(L, i + 1);
+		lua_rawseti(L, -2, (lua_Integer)i + 1);
+	}
+	lua_setuservalue(L, -2);
+	if (! pool_submit(f)) {
+		f->waited = 1;
+		sem_destroy(&(f->done));
+		scratch_free(&scratch);
+		f->spill = NULL;
+		return report("cannot start worker threads");
+	}
+	// mappings are not unmapped under the call, see future_wait()
+	for (i = 0; i < argc; i++) {
+		dlffi_Mmap *m = value_mapping(L, (int)i + 2);
+		if (m) m->busy++;
+	}
+	return 1;
 }
-/* }}} dlffi_run */
+/* }}} dlffi_async */
+
+/* {{{ void future_wait(lua_State *L, dlffi_Future *f) */
+//	the future is at 1, its uservalue holds the arguments
+static void future_wait(lua_State *L, dlffi_Future *f)
+{
+	if (f->waited) return;
+	while (sem_wait(&(f->done)) != 0);
+	sem_destroy(&(f->done));
+	f->waited = 1;
+	dlffi_Scratch s = { .spill = f->spill };
+	scratch_free(&s);
+	f->spill = NULL;
+	if (lua_checkstack(L, 2) == 0) return;
+	if (lua_getuservalue(L, 1) == LUA_TTABLE) {
+		lua_Integer i, n = (lua_Integer)f->func->argc + 1;
+		for (i = 2; i <= n; i++) {
+			lua_rawgeti(L, -1, i);
+			dlffi_Mmap *m = value_mapping(L, -1);
+			if (m && m->busy) m->busy--;
+			lua_pop(L, 1);
+		}
+	}
+	lua_pop(L, 1);
+}
+/* }}} future_wait */
+
+/* {{{ bool dlffi_Future:ready() */
+static int l_dlffi_Future_ready(lua_State *L) {
+	dlffi_Future *f = luaL_checkudata(L, 1, "dlffi_Future");
+	lua_pushboolean(L,
+		atomic_load_explicit(&f->ready, memory_order_acquire));
+	return 1;
+}
+/* }}} dlffi_Future_ready */
+
+/* {{{ ... dlffi_Future:result() */
+//	block until the call is finished, return its value
+static int l_dlffi_Future_result(lua_State *L) {
+	dlffi_Future *f = luaL_checkudata(L, 1, "dlffi_Future");
+	future_wait(L, f);
+	if (f->func->type == &ffi_type_void) return 0;
+	if (lua_checkstack(L, 1) == 0) return 0;
+	return f->func->plan[f->func->argc].push(L, f->ret);
+}
+/* }}} dlffi_Future_result */
+
+/* {{{ ... dlffi_Future:await() */
+//	inside a coroutine yield the future until the call is finished,
+//	block otherwise; return the value of the call
+static int future_await(lua_State *L, int status, lua_KContext ctx) {
+	(void)status;
+	(void)ctx;
+	dlffi_Future *f = luaL_checkudata(L, 1, "dlffi_Future");
+	lua_settop(L, 1);
+	if (lua_isyieldable(L) &&
+		! atomic_load_explicit(&f->ready, memory_order_acquire)) {
+		lua_pushvalue(L, 1);
+		return lua_yieldk(L, 1, 0, future_await);
+	}
+	return l_dlffi_Future_result(L);
+}
+
+static int l_dlffi_Future_await(lua_State *L) {
+	return future_await(L, LUA_OK, 0);
+}
+/* }}} dlffi_Future_await */
+
+/* {{{ void dlffi_Future_gc(dlffi_Future) */
+//	the frame belongs to the future, so the call must be finished
+static int dlffi_Future_gc(lua_State *L) {
+	dlffi_Future *f = luaL_checkudata(L, 1, "dlffi_Future");
+	future_wait(L, f);
+	return 0;
+}
+/* }}} dlffi_Future_gc */
 
 /* {{{ void dlffi_Pointer_gc(dlffi_Pointer *) */
 static int dlffi_Pointer_gc(lua_State *L) {
@@ -689,8 +3414,13 @@ static int dlffi_Pointer_gc(lua_State *L) {
 		o->pointer = NULL; // avoid further pointer usage
 		return 0;
 	}
-	free(o->pointer);
+	if (o->gc == DLFFI_GC_MUNMAP) {
+		dlffi_Mmap *m = (dlffi_Mmap *)o;
+		munmap(m->base, m->size);
+		o->gc = 0;
+	} else free(o->pointer);
 	o->pointer = NULL; // avoid further pointer usage
+	o->size = 0;
 	return 0;
 }
 /* }}} dlffi_Pointer_gc */
@@ -700,6 +3430,7 @@ static int l_dlffi_Pointer(lua_State *L) {
 	if ( lua_checkstack(L, 2) == 0 ) return 0;
 	dlffi_Pointer *o = lua_newuserdata(L, sizeof(dlffi_Pointer));
 	if (o == NULL) return 0;
+	o->size = 0;
 	if (lua_gettop(L) == 1) o->pointer = NULL;
 	else {
 		switch (lua_type(L, 1)) {
@@ -712,6 +3443,7 @@ static int l_dlffi_Pointer(lua_State *L) {
 		case LUA_TNUMBER:
 			o->pointer = malloc(lua_tointeger(L, 1));
 			if (o->pointer == NULL) return 0;
+			o->size = (size_t)lua_tointeger(L, 1);
 			break;
 		case LUA_TNIL:
 			o->pointer = NULL;
@@ -720,15 +3452,193 @@ static int l_dlffi_Pointer(lua_State *L) {
 			return 0;
 		}
 	}
-	luaL_getmetatable(L, "dlffi_Pointer");
-	if ((lua_type(L, 2) == LUA_TBOOLEAN) && lua_toboolean(L, 2)) {
-		o->gc = 1;
-	} else o->gc = 0;
-	o->ref = LUA_REFNIL;
-	lua_setmetatable(L, -2);
+	luaL_getmetatable(L, "dlffi_Pointer");
+	if ((lua_type(L, 2) == LUA_TBOOLEAN) && lua_toboolean(L, 2)) {
+		o->gc = 1;
+	} else o->gc = 0;
+	o->ref = LUA_REFNIL;
+	lua_setmetatable(L, -2);
+	return 1;
+}
+/* }}} dlffi_Pointer */
+
+/* {{{ memory mapped files */
+/* {{{ dlffi_Pointer, len dl.mmap(path[, mode[, offset[, length]]]) */
+//	map length bytes (the rest of the file by default) of the file from
+//	the offset; mode is "r" for reading, "rw" for shared writable
+//	mapping or "c" for private copy-on-write one
+//	Return: dlffi_Pointer unmapped by GC and the length
+static int l_dlffi_mmap(lua_State *L) {
+	static const char *modes[] = { "r", "rw", "c", NULL };
+	const char *path = luaL_checkstring(L, 1);
+	int mode = luaL_checkoption(L, 2, "r", modes);
+	lua_Integer off = luaL_optinteger(L, 3, 0);
+	luaL_argcheck(L, off >= 0, 3, "negative offset");
+	inline int report(const char *what) {
+		int e = errno;
+		if ( lua_checkstack(L, 2) == 0 ) return 0;
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: %s: %s", path, what, strerror(e));
+		return 2;
+	};
+	int fd = open(path, (mode == 1) ? O_RDWR : O_RDONLY);
+	if (fd < 0) return report("open() failed");
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		int r = report("fstat() failed");
+		close(fd);
+		return r;
+	}
+	// pages past the end of the file raise SIGBUS when touched
+	inline int refuse(const char *what) {
+		close(fd);
+		errno = EINVAL;
+		return report(what);
+	};
+	if (off > (lua_Integer)st.st_size)
+		return refuse("offset beyond the end of the file");
+	lua_Integer len;
+	if (lua_isnoneornil(L, 4)) len = (lua_Integer)st.st_size - off;
+	else len = luaL_checkinteger(L, 4);
+	if (len <= 0) return refuse("nothing to map");
+	if (len > (lua_Integer)st.st_size - off)
+		return refuse("length beyond the end of the file");
+	// mmap() takes page aligned offsets only
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t skip = (size_t)off % page;
+	int prot = (mode == 0) ? PROT_READ : (PROT_READ | PROT_WRITE);
+	int flags = (mode == 1) ? MAP_SHARED : MAP_PRIVATE;
+	void *base = mmap(NULL, (size_t)len + skip, prot, flags, fd,
+		(off_t)((size_t)off - skip));
+	if (base == MAP_FAILED) {
+		int r = report("mmap() failed");
+		close(fd);
+		return r;
+	}
+	// the mapping does not need the descriptor
+	close(fd);
+	if (lua_checkstack(L, 3) == 0) {
+		munmap(base, (size_t)len + skip);
+		return 0;
+	}
+	dlffi_Mmap *m = lua_newuserdata(L, sizeof(dlffi_Mmap));
+	if (!m) {
+		munmap(base, (size_t)len + skip);
+		return 0;
+	}
+	m->p.pointer = (char *)base + skip;
+	m->p.gc = DLFFI_GC_MUNMAP;
+	m->p.ref = LUA_REFNIL;
+	m->p.size = (size_t)len;
+	m->base = base;
+	m->size = (size_t)len + skip;
+	m->len = (size_t)len;
+	m->shared = (mode == 1);
+	m->prot = prot;
+	m->busy = 0;
+	luaL_getmetatable(L, "dlffi_Pointer");
+	lua_setmetatable(L, -2);
+	lua_pushinteger(L, len);
+	return 2;
+}
+/* }}} dlffi_mmap */
+
+/* {{{ dlffi_Mmap *mmap_range(lua_State *L, void **addr, size_t *size) */
+//	check the mapped dlffi_Pointer at 1 and read the page aligned range
+//	of bytes from the offset at 3 of the length at 4, the whole mapping
+//	by default
+static dlffi_Mmap *mmap_range(lua_State *L, void **addr, size_t *size)
+{
+	dlffi_Mmap *m = (dlffi_Mmap *)dlffi_check_Pointer(L, 1);
+	luaL_argcheck(L, m->p.gc == DLFFI_GC_MUNMAP, 1, "not a mapped file");
+	lua_Integer off = luaL_optinteger(L, 3, 0);
+	lua_Integer len = luaL_optinteger(L, 4, (lua_Integer)m->len - off);
+	luaL_argcheck(L, (off >= 0) && ((size_t)off <= m->len), 3,
+		"offset out of the mapping");
+	luaL_argcheck(L, (len >= 0) && ((size_t)len <= m->len - (size_t)off), 4,
+		"length out of the mapping");
+	char *from = (char *)m->p.pointer + off;
+	size_t skip = (size_t)(from - (char *)m->base) %
+		(size_t)sysconf(_SC_PAGESIZE);
+	*addr = from - skip;
+	*size = (size_t)len + skip;
+	return m;
+}
+/* }}} mmap_range */
+
+/* {{{ bool dlffi_Pointer:madvise(advice[, offset[, length]]) */
+//	hint the kernel on the use of the mapped bytes: "normal", "random",
+//	"sequential", "willneed" to prefetch them or "dontneed"
+static int l_dlffi_Pointer_madvise(lua_State *L) {
+	static const char *names[] = {
+		"normal", "random", "sequential", "willneed", "dontneed", NULL
+	};
+	static const int advice[] = {
+		MADV_NORMAL, MADV_RANDOM, MADV_SEQUENTIAL, MADV_WILLNEED,
+		MADV_DONTNEED
+	};
+	int a = luaL_checkoption(L, 2, NULL, names);
+	void *addr;
+	size_t size;
+	mmap_range(L, &addr, &size);
+	if (lua_checkstack(L, 2) == 0) return 0;
+	if (madvise(addr, size, advice[a]) != 0) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "madvise() failed: %s", strerror(errno));
+		return 2;
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+}
+/* }}} dlffi_Pointer_madvise */
+
+/* {{{ bool dlffi_Pointer:msync([async[, offset[, length]]]) */
+//	write changes of the shared writable mapping to the file,
+//	waiting for the writes unless async is true
+static int l_dlffi_Pointer_msync(lua_State *L) {
+	void *addr;
+	size_t size;
+	dlffi_Mmap *m = mmap_range(L, &addr, &size);
+	int flags = lua_toboolean(L, 2) ? MS_ASYNC : MS_SYNC;
+	if (lua_checkstack(L, 2) == 0) return 0;
+	if (! m->shared) {
+		lua_pushnil(L);
+		lua_pushstring(L, "mapping is not writable to the file");
+		return 2;
+	}
+	if (msync(addr, size, flags) != 0) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "msync() failed: %s", strerror(errno));
+		return 2;
+	}
+	lua_pushboolean(L, 1);
 	return 1;
 }
-/* }}} dlffi_Pointer */
+/* }}} dlffi_Pointer_msync */
+
+/* {{{ bool dlffi_Pointer:munmap() */
+//	unmap the file before the GC does, the pointer becomes NULL and
+//	views of it raise errors; refused while async() calls take it
+static int l_dlffi_Pointer_munmap(lua_State *L) {
+	dlffi_Mmap *m = (dlffi_Mmap *)dlffi_check_Pointer(L, 1);
+	luaL_argcheck(L, m->p.gc == DLFFI_GC_MUNMAP, 1, "not a mapped file");
+	if (lua_checkstack(L, 2) == 0) return 0;
+	if (m->busy) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "mapping is used by %d pending calls",
+			m->busy);
+		return 2;
+	}
+	munmap(m->base, m->size);
+	m->p.gc = 0;
+	m->p.pointer = NULL;
+	m->p.size = 0;
+	m->len = 0;
+	lua_pushboolean(L, 1);
+	return 1;
+}
+/* }}} dlffi_Pointer_munmap */
+/* }}} memory mapped files */
 
 /* {{{ dlffi_Pointer_copy(void *) */
 //	make a copy of the given pointer
@@ -741,24 +3651,192 @@ static int l_dlffi_Pointer_copy(lua_State *L) {
 	luaL_getmetatable(L, "dlffi_Pointer");
 	o->gc = 0;
 	o->ref = LUA_REFNIL;
+	o->size = p->size;
 	lua_setmetatable(L, -2);
 	return 1;
 }
 /* }}} dlffi_Pointer_copy */
 
+/* {{{ struct dlffi_Chunk */
+// memory block of an arena
+typedef struct dlffi_Chunk {
+	struct dlffi_Chunk *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+} dlffi_Chunk;
+/* }}} struct dlffi_Chunk */
+
+/* {{{ struct dlffi_Arena */
+// bump allocator for short living buffers, freed at once
+typedef struct dlffi_Arena {
+	// the current chunk, older chunks follow
+	dlffi_Chunk *chunk;
+	// default size of a new chunk
+	size_t size;
+} dlffi_Arena;
+/* }}} struct dlffi_Arena */
+
+/* {{{ void arena_free(dlffi_Chunk *c) */
+static void arena_free(dlffi_Chunk *c)
+{
+	while (c) {
+		dlffi_Chunk *next = c->next;
+		free(c);
+		c = next;
+	}
+}
+/* }}} arena_free */
+
+/* {{{ void *arena_alloc(dlffi_Arena *a, size_t size, size_t align) */
+static void *arena_alloc(dlffi_Arena *a, size_t size, size_t align)
+{
+	dlffi_Chunk *c = a->chunk;
+	if (c) {
+		size_t pos = (c->used + align - 1) & ~(align - 1);
+		if (pos + size <= c->size) {
+			c->used = pos + size;
+			return (char *)c->data + pos;
+		}
+	}
+	size_t csize = (size > a->size) ? size : a->size;
+	c = malloc(sizeof(dlffi_Chunk) + csize);
+	if (!c) return NULL;
+	c->size = csize;
+	c->used = size;
+	if ((a->chunk == NULL) || (size <= a->size)) {
+		c->next = a->chunk;
+		a->chunk = c;
+	} else {
+		// keep bumping the current chunk after a large allocation
+		c->next = a->chunk->next;
+		a->chunk->next = c;
+	}
+	return c->data;
+}
+/* }}} arena_alloc */
+
+/* {{{ dlffi_Arena dlffi_arena([size]) */
+static int l_dlffi_arena(lua_State *L) {
+	lua_Integer size = luaL_optinteger(L, 1, 4096);
+	luaL_argcheck(L, size > 0, 1, "chunk size must be positive");
+	if (lua_checkstack(L, 2) == 0) return 0;
+	dlffi_Arena *a = lua_newuserdata(L, sizeof(dlffi_Arena));
+	if (!a) return 0;
+	a->chunk = NULL;
+	a->size = (size_t)size;
+	luaL_getmetatable(L, "dlffi_Arena");
+	lua_setmetatable(L, -2);
+	return 1;
+}
+/* }}} dlffi_arena */
+
+/* {{{ dlffi_Pointer dlffi_Arena:alloc(size[, align]) */
+//	the pointer is valid until the arena is reset or collected
+static int l_dlffi_Arena_alloc(lua_State *L) {
+	dlffi_Arena *a = luaL_checkudata(L, 1, "dlffi_Arena");
+	lua_Integer size = luaL_checkinteger(L, 2);
+	lua_Integer align = luaL_optinteger(L, 3, _Alignof(max_align_t));
+	luaL_argcheck(L, size >= 0, 2, "negative size");
+	luaL_argcheck(L, (align > 0) && ((align & (align - 1)) == 0) &&
+		(align <= (lua_Integer)_Alignof(max_align_t)), 3,
+		"invalid alignment");
+	if (lua_checkstack(L, 2) == 0) return 0;
+	void *p = arena_alloc(a, (size_t)size, (size_t)align);
+	if (!p) return 0;
+	dlffi_Pointer *o = lua_newuserdata(L, sizeof(dlffi_Pointer));
+	if (!o) return 0;
+	o->pointer = p;
+	o->gc = 0;
+	o->ref = LUA_REFNIL;
+	o->size = (size_t)size;
+	luaL_getmetatable(L, "dlffi_Pointer");
+	lua_setmetatable(L, -2);
+	return 1;
+}
+/* }}} dlffi_Arena_alloc */
+
+/* {{{ dlffi_Pointer dlffi_Arena:string(s) */
+//	NUL-terminated copy of the Lua string, its length is returned second
+static int l_dlffi_Arena_string(lua_State *L) {
+	dlffi_Arena *a = luaL_checkudata(L, 1, "dlffi_Arena");
+	size_t len;
+	const char *s = luaL_checklstring(L, 2, &len);
+	if (lua_checkstack(L, 3) == 0) return 0;
+	char *p = arena_alloc(a, len + 1, 1);
+	if (!p) return 0;
+	memcpy(p, s, len + 1);
+	dlffi_Pointer *o = lua_newuserdata(L, sizeof(dlffi_Pointer));
+	if (!o) return 0;
+	o->pointer = p;
+	o->gc = 0;
+	o->ref = LUA_REFNIL;
+	o->size = len + 1;
+	luaL_getmetatable(L, "dlffi_Pointer");
+	lua_setmetatable(L, -2);
+	lua_pushinteger(L, (lua_Integer)len);
+	return 2;
+}
+/* }}} dlffi_Arena_string */
+
+/* {{{ void dlffi_Arena:reset() */
+//	invalidate all pointers, keep the current chunk for reuse
+static int l_dlffi_Arena_reset(lua_State *L) {
+	dlffi_Arena *a = luaL_checkudata(L, 1, "dlffi_Arena");
+	if (a->chunk == NULL) return 0;
+	arena_free(a->chunk->next);
+	a->chunk->next = NULL;
+	a->chunk->used = 0;
+	return 0;
+}
+/* }}} dlffi_Arena_reset */
+
+/* {{{ void dlffi_Arena_gc(dlffi_Arena) */
+static int dlffi_Arena_gc(lua_State *L) {
+	dlffi_Arena *a = luaL_checkudata(L, 1, "dlffi_Arena");
+	arena_free(a->chunk);
+	a->chunk = NULL;
+	return 0;
+}
+/* }}} dlffi_Arena_gc */
+
 /* {{{ void dlffi_gc(dlffi_Function *) */
 static int dlffi_gc(lua_State *L) {
 	dlffi_Function *o = lua_touserdata(L, 1);
+	size_t i;
 	if (!o) return 0;
+	if (atomic_load(&o->posted) > 0) {
+		// posted calls are still queued: resurrect the closure until
+		// queue_drain() runs them, then collect it again
+		lua_pushvalue(L, 1);
+		o->pin = luaL_ref(L, LUA_REGISTRYINDEX);
+		lua_getmetatable(L, 1);
+		lua_setmetatable(L, 1);
+		return 0;
+	}
+	if (o->queue) queue_release(o->queue);
+	o->queue = NULL;
 	luaL_unref(L, LUA_REGISTRYINDEX, o->ref);
 	luaL_unref(L, LUA_REGISTRYINDEX, o->ref_table);
-	if (o->dlhdl) {
-		dlclose(o->dlhdl);
-		dlerror();
+	// the name of the counters belongs to the library
+	stats_free(o);
+	lib_close(o->lib);
+	o->lib = NULL;
+	// an interned signature is never freed
+	if (! o->sig) {
+		free(o->types);
+		free(o->plan);
+		free(o->cif);
 	}
-	free(o->types);
 	o->types = NULL; // to avoid further invocation
 	if (o->ret) free(o->ret);
+	free(o->argv);
+	free(o->strbuf);
+	free(o->outs);
+	if (o->varcifs) {
+		for (i = 0; i < DLFFI_VARCIF; i++) varcif_free(&(o->varcifs[i]));
+		free(o->varcifs);
+	}
 	return 0;
 }
 /* }}} dlffi_gc */
@@ -825,6 +3903,7 @@ static int l_dlffi_Pointer_index(lua_State *L) {
 		new->pointer = ((void **)(o->pointer))[(size_t)idx - 1];
 		new->gc = 0;
 		new->ref = LUA_REFNIL;
+		new->size = 0;
 		luaL_getmetatable(L, "dlffi_Pointer");
 		lua_setmetatable(L, -2);
 		lua_pushlightuserdata( L, new->pointer );
@@ -871,6 +3950,473 @@ static int l_dlffi_Pointer_tostring(lua_State *L) {
 }
 /* }}} dlffi_Pointer_tostring */
 
+/* {{{ bool dlffi_Pointer_realloc(dlffi_Pointer, size) */
+//	resize the memory owned by the pointer, see dlffi_Pointer(size, true);
+//	views of the pointer follow the memory, but keep their lengths
+static int l_dlffi_Pointer_realloc(lua_State *L) {
+	dlffi_Pointer *o = dlffi_check_Pointer(L, 1);
+	lua_Integer size = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, size > 0, 2, "size must be positive");
+	if (lua_checkstack(L, 2) == 0) return 0;
+	if (o->gc != 1) {
+		lua_pushnil(L);
+		lua_pushstring(L, "memory is not owned by the pointer");
+		return 2;
+	}
+	void *p = realloc(o->pointer, (size_t)size);
+	if (!p) {
+		lua_pushnil(L);
+		lua_pushstring(L, "realloc() failed");
+		return 2;
+	}
+	o->pointer = p;
+	o->size = (size_t)size;
+	lua_pushboolean(L, 1);
+	return 1;
+}
+/* }}} dlffi_Pointer_realloc */
+
+/* {{{ void *dlffi_Pointer_offset(dlffi_Pointer, n) */
+//	address n bytes after the pointer, valid while the memory is
+static int l_dlffi_Pointer_offset(lua_State *L) {
+	dlffi_Pointer *o = dlffi_check_Pointer(L, 1);
+	lua_Integer n = luaL_checkinteger(L, 2);
+	if (! o->pointer) return 0;
+	lua_pushlightuserdata(L, (char *)o->pointer + n);
+	return 1;
+}
+/* }}} dlffi_Pointer_offset */
+
+/* {{{ n dlffi_Pointer_write(dlffi_Pointer, offset, s) */
+//	copy the Lua string without the terminating NUL n bytes after the
+//	pointer; Return: offset after the copy
+static int l_dlffi_Pointer_write(lua_State *L) {
+	dlffi_Pointer *o = dlffi_check_Pointer(L, 1);
+	lua_Integer off = luaL_checkinteger(L, 2);
+	size_t len;
+	const char *s = luaL_checklstring(L, 3, &len);
+	luaL_argcheck(L, off >= 0, 2, "negative offset");
+	luaL_argcheck(L, ! pointer_readonly(o), 1, "read-only mapping");
+	if (! o->pointer) return 0;
+	memcpy((char *)o->pointer + off, s, len);
+	lua_pushinteger(L, off + (lua_Integer)len);
+	return 1;
+}
+/* }}} dlffi_Pointer_write */
+
+/* {{{ dlffi_View dlffi_Pointer_view(dlffi_Pointer, ffi_type *, n) */
+//	the view keeps the dlffi_Pointer alive, but not the type
+static int l_dlffi_Pointer_view(lua_State *L) {
+	dlffi_Pointer *p = dlffi_check_Pointer(L, 1);
+	luaL_checktype(L, 2, LUA_TLIGHTUSERDATA);
+	ffi_type *t = lua_touserdata(L, 2);
+	luaL_argcheck(L, (t != NULL) && (t->size > 0), 2, "invalid FFI type");
+	lua_Integer n = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, n >= 0, 3, "negative number of elements");
+	if (p->pointer == NULL) return 0;
+	if (lua_checkstack(L, 2) == 0) return 0;
+	dlffi_View *o = lua_newuserdata(L, sizeof(dlffi_View));
+	if (!o) return 0;
+	o->pointer = NULL;
+	o->owner = p;
+	o->type = t;
+	o->n = (size_t)n;
+	o->push = type_pusher(t);
+	o->write = type_writer(t);
+	luaL_getmetatable(L, "dlffi_View");
+	lua_setmetatable(L, -2);
+	lua_pushvalue(L, 1);
+	lua_setuservalue(L, -2);
+	return 1;
+}
+/* }}} dlffi_Pointer_view */
+
+/* {{{ char *view_base(lua_State *L, dlffi_View *o, int idx) */
+//	address of the array, see string_base()
+static char *view_base(lua_State *L, dlffi_View *o, int idx) {
+	char *p = o->owner ? o->owner->pointer : o->pointer;
+	luaL_argcheck(L, p != NULL, idx, "memory of the view is released");
+	return p;
+}
+/* }}} view_base */
+
+/* {{{ void view_range(lua_State *L, dlffi_View *o, size_t *i, size_t *j) */
+//	read [i, j] range from the arguments 2 and 3, it defaults to the view
+static void view_range(lua_State *L, dlffi_View *o, size_t *i, size_t *j) {
+	lua_Integer first = luaL_optinteger(L, 2, 1);
+	lua_Integer last = luaL_optinteger(L, 3, (lua_Integer)o->n);
+	luaL_argcheck(L, first >= 1, 2, "index out of the view");
+	luaL_argcheck(L, last <= (lua_Integer)o->n, 3, "index out of the view");
+	*i = (size_t)first;
+	*j = (last < first) ? (size_t)first - 1 : (size_t)last;
+}
+/* }}} view_range */
+
+/* {{{ table dlffi_View:read([i[, j[, table]]]) */
+//	elements i..j are stored at 1..j-i+1 of the given or a new table
+static int l_dlffi_View_read(lua_State *L) {
+	dlffi_View *o = luaL_checkudata(L, 1, "dlffi_View");
+	size_t i, j, k;
+	view_range(L, o, &i, &j);
+	if (lua_checkstack(L, 3) == 0) return 0;
+	if (lua_istable(L, 4)) lua_pushvalue(L, 4);
+	else lua_createtable(L, (int)(j - i + 1), 0);
+	char *p = view_base(L, o, 1) + (i - 1) * o->type->size;
+	for (k = 1; i <= j; i++, k++, p += o->type->size) {
+		if (o->push(L, p) != 1) return 0;
+		lua_rawseti(L, -2, (lua_Integer)k);
+	}
+	return 1;
+}
+/* }}} dlffi_View_read */
+
+/* {{{ n dlffi_View:write(i, table[, dlffi_Arena]) */
+//	table elements 1..#table are stored starting from the i-th element;
+//	strings are copied to the arena, which the viewed dlffi_Pointer then
+//	keeps alive, and refused without one
+static int l_dlffi_View_write(lua_State *L) {
+	dlffi_View *o = luaL_checkudata(L, 1, "dlffi_View");
+	lua_Integer i = luaL_checkinteger(L, 2);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	dlffi_Scratch s = { NULL, 0, NULL, 0, NULL };
+	if (! lua_isnoneornil(L, 4))
+		s.arena = luaL_checkudata(L, 4, "dlffi_Arena");
+	size_t len = lua_rawlen(L, 3), k;
+	luaL_argcheck(L, (i >= 1) && ((size_t)i - 1 + len <= o->n), 2,
+		"elements out of the view");
+	luaL_argcheck(L, ! pointer_readonly(o->owner), 1, "read-only mapping");
+	if (lua_checkstack(L, 2) == 0) return 0;
+	char *p = view_base(L, o, 1) + ((size_t)i - 1) * o->type->size;
+	for (k = 1; k <= len; k++, p += o->type->size) {
+		lua_rawgeti(L, 3, (lua_Integer)k);
+		if (o->write(L, -1, o->type, p, NULL, &s) == NULL) {
+			lua_pushnil(L);
+			lua_pushfstring(L, "cannot write element #%d", (int)k);
+			return 2;
+		}
+		if (s.spill) {
+			scratch_free(&s);
+			lua_pushnil(L);
+			lua_pushfstring(L, "element #%d is a string, "
+				"but no arena is given", (int)k);
+			return 2;
+		}
+		lua_pop(L, 1);
+	}
+	if (s.arena) {
+		lua_getuservalue(L, 1);
+		if (luaL_testudata(L, -1, "dlffi_Pointer")) pointer_pin(L, -1, 4);
+		lua_pop(L, 1);
+	}
+	lua_pushinteger(L, (lua_Integer)len);
+	return 1;
+}
+/* }}} dlffi_View_write */
+
+/* {{{ table dlffi_View:tostrings([lengths[, i[, j[, keys[, table]]]]]) */
+//	array of (char *) to Lua strings, lengths is either a number, an array
+//	of numbers per element, a dlffi_View of integers, or nil for
+//	NUL-terminated strings; the k-th string is stored at keys[k] if keys
+//	are given, else at k; NULL pointers are stored as false, or nil
+//	with keys
+static int l_dlffi_View_tostrings(lua_State *L) {
+	dlffi_View *o = luaL_checkudata(L, 1, "dlffi_View");
+	luaL_argcheck(L, (o->type == &ffi_type_pointer) ||
+		(o->type == &dlffi_type_cstring), 1, "not a view of pointers");
+	int lt = lua_type(L, 2);
+	lua_Integer fixed = -1;
+	dlffi_View *lv = NULL;
+	if (lt == LUA_TNUMBER) fixed = lua_tointeger(L, 2);
+	else if (lt == LUA_TUSERDATA) lv = luaL_checkudata(L, 2, "dlffi_View");
+	else if ((lt != LUA_TNIL) && (lt != LUA_TNONE))
+		luaL_checktype(L, 2, LUA_TTABLE);
+	lua_Integer first = luaL_optinteger(L, 3, 1);
+	lua_Integer last = luaL_optinteger(L, 4, (lua_Integer)o->n);
+	luaL_argcheck(L, first >= 1, 3, "index out of the view");
+	luaL_argcheck(L, last <= (lua_Integer)o->n, 4, "index out of the view");
+	luaL_argcheck(L, (lv == NULL) || (last - first < (lua_Integer)lv->n),
+		2, "not enough lengths");
+	int keys = lua_istable(L, 5) ? 5 : 0;
+	if (lua_checkstack(L, 4) == 0) return 0;
+	if (lua_istable(L, 6)) lua_pushvalue(L, 6);
+	else lua_createtable(L, (last < first) ? 0 : (int)(last - first + 1), 0);
+	char **p = (char **)view_base(L, o, 1) + (first - 1);
+	char *lp = lv ? view_base(L, lv, 2) : NULL;
+	lua_Integer k;
+	for (k = 1; first <= last; first++, k++, p++) {
+		if (keys) lua_rawgeti(L, keys, k);
+		if (*p == NULL) {
+			if (keys) lua_pushnil(L);
+			else lua_pushboolean(L, 0);
+		} else if (lt == LUA_TTABLE) {
+			lua_rawgeti(L, 2, k);
+			lua_Integer len = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			lua_pushlstring(L, *p, (size_t)(len > 0 ? len : 0));
+		} else if (lv) {
+			lv->push(L, lp + (k - 1) * lv->type->size);
+			lua_Integer len = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			lua_pushlstring(L, *p, (size_t)(len > 0 ? len : 0));
+		} else if (fixed >= 0) lua_pushlstring(L, *p, (size_t)fixed);
+		else lua_pushstring(L, *p);
+		if (keys) lua_rawset(L, -3);
+		else lua_rawseti(L, -2, k);
+	}
+	return 1;
+}
+/* }}} dlffi_View_tostrings */
+
+/* {{{ void dlffi_View:rebind(void * | dlffi_Pointer) */
+//	point the view to another array of the same type and length
+static int l_dlffi_View_rebind(lua_State *L) {
+	dlffi_View *o = luaL_checkudata(L, 1, "dlffi_View");
+	void *p;
+	dlffi_Pointer *owner = NULL;
+	if (lua_type(L, 2) == LUA_TLIGHTUSERDATA) {
+		p = lua_touserdata(L, 2);
+		lua_pushnil(L);
+	} else {
+		owner = dlffi_check_Pointer(L, 2);
+		p = owner->pointer;
+		lua_pushvalue(L, 2);
+	}
+	luaL_argcheck(L, p != NULL, 2, "NULL pointer");
+	o->pointer = owner ? NULL : p;
+	o->owner = owner;
+	lua_setuservalue(L, 1);
+	return 0;
+}
+/* }}} dlffi_View_rebind */
+
+/* {{{ n dlffi_View_len(dlffi_View) */
+static int dlffi_View_len(lua_State *L) {
+	dlffi_View *o = luaL_checkudata(L, 1, "dlffi_View");
+	lua_pushinteger(L, (lua_Integer)o->n);
+	return 1;
+}
+/* }}} dlffi_View_len */
+
+/* {{{ dlffi_String string_new(lua_State *L, const char *p, size_t len, int src) */
+//	push a string view, which keeps alive the value at src, if any;
+//	the view of a dlffi_Pointer at src follows its memory
+static dlffi_String *string_new(
+	lua_State *L,
+	const char *p,
+	size_t len,
+	int src
+) {
+	if (lua_checkstack(L, 2) == 0) return NULL;
+	dlffi_String *o = lua_newuserdata(L, sizeof(dlffi_String));
+	if (!o) return NULL;
+	o->pointer = p;
+	o->len = len;
+	o->owner = src ? luaL_testudata(L, src, "dlffi_Pointer") : NULL;
+	o->offset = o->owner ? (size_t)(p - (char *)o->owner->pointer) : 0;
+	luaL_getmetatable(L, "dlffi_String");
+	lua_setmetatable(L, -2);
+	if (src) {
+		lua_pushvalue(L, src);
+		lua_setuservalue(L, -2);
+	}
+	return o;
+}
+/* }}} string_new */
+
+/* {{{ dlffi_String dl.strview(void * | dlffi_Pointer[, len]) */
+//	view of len bytes or of the NUL-terminated string at the pointer;
+//	the view keeps the dlffi_Pointer alive, also Pointer:strview([len]);
+//	the view stays within the memory of a pointer of known size
+static int l_dlffi_strview(lua_State *L) {
+	const char *p;
+	int src = 0;
+	size_t size = 0;
+	if (lua_type(L, 1) == LUA_TLIGHTUSERDATA) p = lua_touserdata(L, 1);
+	else {
+		dlffi_Pointer *o = dlffi_check_Pointer(L, 1);
+		p = o->pointer;
+		size = o->size;
+		src = 1;
+	}
+	luaL_argcheck(L, p != NULL, 1, "NULL pointer");
+	size_t len;
+	if (lua_isnoneornil(L, 2)) len = size ? strnlen(p, size) : strlen(p);
+	else {
+		lua_Integer n = luaL_checkinteger(L, 2);
+		luaL_argcheck(L, n >= 0, 2, "negative length");
+		luaL_argcheck(L, (size == 0) || ((size_t)n <= size), 2,
+			"length exceeds the memory of the pointer");
+		len = (size_t)n;
+	}
+	return string_new(L, p, len, src) ? 1 : 0;
+}
+/* }}} dlffi_strview */
+
+/* {{{ dlffi_String *string_check(lua_State *L, int idx, dlffi_String *tmp) */
+//	view of the dlffi_String or of the Lua string at the index
+static dlffi_String *string_check(lua_State *L, int idx, dlffi_String *tmp)
+{
+	if (lua_type(L, idx) == LUA_TSTRING) {
+		tmp->pointer = lua_tolstring(L, idx, &(tmp->len));
+		return tmp;
+	}
+	dlffi_String *o = luaL_checkudata(L, idx, "dlffi_String");
+	tmp->pointer = string_base(o);
+	luaL_argcheck(L, tmp->pointer != NULL, idx,
+		"memory of the view is released");
+	tmp->len = o->len;
+	return tmp;
+}
+/* }}} string_check */
+
+/* {{{ int string_cmp(dlffi_String *a, dlffi_String *b) */
+static int string_cmp(dlffi_String *a, dlffi_String *b)
+{
+	size_t len = (a->len < b->len) ? a->len : b->len;
+	int r = memcmp(a->pointer, b->pointer, len);
+	if (r != 0) return r;
+	return (a->len > b->len) - (a->len < b->len);
+}
+/* }}} string_cmp */
+
+/* {{{ bool dlffi_String_eq(dlffi_String, dlffi_String | string) */
+//	also dlffi_String:equals(), which compares with Lua strings too
+static int dlffi_String_eq(lua_State *L) {
+	dlffi_String ta, tb;
+	dlffi_String *a = string_check(L, 1, &ta);
+	dlffi_String *b = string_check(L, 2, &tb);
+	lua_pushboolean(L, (a->len == b->len) &&
+		(memcmp(a->pointer, b->pointer, a->len) == 0));
+	return 1;
+}
+/* }}} dlffi_String_eq */
+
+/* {{{ bool dlffi_String_lt(dlffi_String, dlffi_String) */
+static int dlffi_String_lt(lua_State *L) {
+	dlffi_String ta, tb;
+	lua_pushboolean(L, string_cmp(
+		string_check(L, 1, &ta), string_check(L, 2, &tb)
+	) < 0);
+	return 1;
+}
+/* }}} dlffi_String_lt */
+
+/* {{{ bool dlffi_String_le(dlffi_String, dlffi_String) */
+static int dlffi_String_le(lua_State *L) {
+	dlffi_String ta, tb;
+	lua_pushboolean(L, string_cmp(
+		string_check(L, 1, &ta), string_check(L, 2, &tb)
+	) <= 0);
+	return 1;
+}
+/* }}} dlffi_String_le */
+
+/* {{{ n dlffi_String_len(dlffi_String) */
+static int dlffi_String_len(lua_State *L) {
+	dlffi_String *o = luaL_checkudata(L, 1, "dlffi_String");
+	lua_pushinteger(L, (lua_Integer)o->len);
+	return 1;
+}
+/* }}} dlffi_String_len */
+
+/* {{{ string dlffi_String_tostring(dlffi_String) */
+//	copy the bytes to a Lua string
+static int dlffi_String_tostring(lua_State *L) {
+	dlffi_String t, *o = string_check(L, 1, &t);
+	lua_pushlstring(L, o->pointer, o->len);
+	return 1;
+}
+/* }}} dlffi_String_tostring */
+
+/* {{{ n dlffi_String:hash() */
+//	64-bit FNV-1a hash of the bytes
+static int l_dlffi_String_hash(lua_State *L) {
+	dlffi_String t, *o = string_check(L, 1, &t);
+	u_int64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+	for (i = 0; i < o->len; i++) {
+		h ^= (unsigned char)o->pointer[i];
+		h *= 0x100000001b3ULL;
+	}
+	lua_pushinteger(L, (lua_Integer)h);
+	return 1;
+}
+/* }}} dlffi_String_hash */
+
+/* {{{ dlffi_String dlffi_String:sub([i[, j]]) */
+//	view of the bytes i..j, indices are as of string.sub()
+static int l_dlffi_String_sub(lua_State *L) {
+	luaL_checkudata(L, 1, "dlffi_String");
+	dlffi_String t, *o = string_check(L, 1, &t);
+	lua_Integer len = (lua_Integer)o->len;
+	lua_Integer i = luaL_optinteger(L, 2, 1);
+	lua_Integer j = luaL_optinteger(L, 3, -1);
+	if (i < 0) i = (-i > len) ? 1 : len + i + 1;
+	else if (i == 0) i = 1;
+	if (j < 0) j = len + j + 1;
+	else if (j > len) j = len;
+	if (i > j) j = i - 1;
+	lua_settop(L, 1);
+	lua_getuservalue(L, 1);
+	return string_new(L, o->pointer + i - 1, (size_t)(j - i + 1),
+		(lua_type(L, 2) == LUA_TNIL) ? 0 : 2) ? 1 : 0;
+}
+/* }}} dlffi_String_sub */
+
+/* {{{ void *dlffi_String:pointer() */
+static int l_dlffi_String_pointer(lua_State *L) {
+	dlffi_String *o = luaL_checkudata(L, 1, "dlffi_String");
+	lua_pushlightuserdata(L, (void *)string_base(o));
+	return 1;
+}
+/* }}} dlffi_String_pointer */
+
+/* {{{ dlffi_Library *dlffi_dlopen(char *library) */
+//	take a reference to the shared handler of the library
+static int l_dlffi_dlopen(lua_State *L) {
+	const char *path = luaL_checkstring(L, 1);
+	if ( lua_checkstack(L, 2) == 0 ) return 0;
+	dlffi_Library **o = lua_newuserdata(L, sizeof(dlffi_Library *));
+	if (!o) return 0;
+	char e[256];
+	*o = lib_open(path, e, sizeof(e));
+	if (! *o) {
+		lua_pushnil(L);
+		lua_pushstring(L, e);
+		return 2;
+	}
+	luaL_getmetatable(L, "dlffi_Library");
+	lua_setmetatable(L, -2);
+	return 1;
+}
+/* }}} dlffi_dlopen */
+
+/* {{{ void *dlffi_Library_sym(dlffi_Library, char *name) */
+static int l_dlffi_Library_sym(lua_State *L) {
+	dlffi_Library **o = luaL_checkudata(L, 1, "dlffi_Library");
+	const char *name = luaL_checkstring(L, 2);
+	if ( lua_checkstack(L, 2) == 0 ) return 0;
+	char e[256];
+	dlffi_Symbol *sym = *o ? lib_sym(*o, name, e, sizeof(e)) : NULL;
+	if (! sym) {
+		lua_pushnil(L);
+		lua_pushstring(L, *o ? e : "library is closed");
+		return 2;
+	}
+	lua_pushlightuserdata(L, sym->address);
+	return 1;
+}
+/* }}} dlffi_Library_sym */
+
+/* {{{ void dlffi_Library_gc(dlffi_Library) */
+static int dlffi_Library_gc(lua_State *L) {
+	dlffi_Library **o = luaL_checkudata(L, 1, "dlffi_Library");
+	lib_close(*o);
+	*o = NULL;
+	return 0;
+}
+/* }}} dlffi_Library_gc */
+
 /* {{{ size_t dlffi_sizeof(char *type) */
 static int l_dlffi_sizeof(lua_State *L) {
 	ffi_type *p = NULL;
@@ -919,13 +4465,29 @@ static const struct luaL_Reg liblua_dlffi [] = {
 	{"type_offset", l_dlffi_type_offset},
 	{"type_element", l_dlffi_type_element},
 	{"type_free", l_dlffi_type_free},
+	{"type_view", l_dlffi_type_view},
+	{"type_decode", l_dlffi_type_decode},
+	{"type_encode", l_dlffi_type_encode},
 	{"load", l_dlffi_load},
 	{"sizeof", l_dlffi_sizeof},
 	{"dlffi_Pointer", l_dlffi_Pointer},
+	{"batch", l_dlffi_batch},
+	{"dlopen", l_dlffi_dlopen},
+	{"poll", l_dlffi_poll},
+	{"poll_hook", l_dlffi_poll_hook},
+	{"async_workers", l_dlffi_async_workers},
+	{"arena", l_dlffi_arena},
+	{"stats", l_dlffi_stats},
+	{"stats_reset", l_dlffi_stats_reset},
+	{"strview", l_dlffi_strview},
+	{"mmap", l_dlffi_mmap},
 	{NULL, NULL}
 };
 
 static const struct luaL_Reg liblua_dlffi_m [] = {
+	{"map", l_dlffi_map},
+	{"async", l_dlffi_async},
+	{"vcall", l_dlffi_vcall},
 	{NULL, NULL}
 };
 
@@ -934,21 +4496,72 @@ static const struct luaL_Reg liblua_dlffi_Pointer_m [] = {
 	{"tostring", l_dlffi_Pointer_tostring},
 	{"set_gc", l_dlffi_Pointer_set_gc},
 	{"copy", l_dlffi_Pointer_copy},
+	{"view", l_dlffi_Pointer_view},
+	{"realloc", l_dlffi_Pointer_realloc},
+	{"offset", l_dlffi_Pointer_offset},
+	{"write", l_dlffi_Pointer_write},
+	{"strview", l_dlffi_strview},
+	{"madvise", l_dlffi_Pointer_madvise},
+	{"msync", l_dlffi_Pointer_msync},
+	{"munmap", l_dlffi_Pointer_munmap},
+	{NULL, NULL}
+};
+
+static const struct luaL_Reg liblua_dlffi_String_m [] = {
+	{"equals", dlffi_String_eq},
+	{"hash", l_dlffi_String_hash},
+	{"sub", l_dlffi_String_sub},
+	{"pointer", l_dlffi_String_pointer},
+	{"tostring", dlffi_String_tostring},
+	{NULL, NULL}
+};
+
+static const struct luaL_Reg liblua_dlffi_View_m [] = {
+	{"read", l_dlffi_View_read},
+	{"write", l_dlffi_View_write},
+	{"tostrings", l_dlffi_View_tostrings},
+	{"rebind", l_dlffi_View_rebind},
+	{NULL, NULL}
+};
+
+static const struct luaL_Reg liblua_dlffi_Future_m [] = {
+	{"ready", l_dlffi_Future_ready},
+	{"result", l_dlffi_Future_result},
+	{"await", l_dlffi_Future_await},
+	{NULL, NULL}
+};
+
+static const struct luaL_Reg liblua_dlffi_Arena_m [] = {
+	{"alloc", l_dlffi_Arena_alloc},
+	{"string", l_dlffi_Arena_string},
+	{"reset", l_dlffi_Arena_reset},
+	{NULL, NULL}
+};
+
+static const struct luaL_Reg liblua_dlffi_Library_m [] = {
+	{"sym", l_dlffi_Library_sym},
+	{"close", dlffi_Library_gc},
 	{NULL, NULL}
 };
 
 int luaopen_liblua_dlffi(lua_State *L) {
 	static char been_here;
-	if ( lua_checkstack(L, 3) == 0 ) return 0;
+	if ( lua_checkstack(L, 8) == 0 ) return 0;
 	if (!been_here) {
 	/* {{{ dlffi_Function metatable */
 	luaL_newmetatable(L, "dlffi_Function");
+	lua_pushstring(L, "__index");
+	lua_pushvalue(L, -2);
+	lua_settable(L, -3);
 	lua_pushstring(L, "__gc");
 	lua_pushcfunction(L, dlffi_gc);
 	lua_settable(L, -3);
 	lua_pushstring(L, "__call");
 	lua_pushcfunction(L, dlffi_run);
 	lua_settable(L, -3);
+	lua_pushstring(L, "__close");
+	lua_pushcfunction(L, dlffi_close);
+	lua_settable(L, -3);
 	luaL_setfuncs(L, liblua_dlffi_m, 0);
 	/* }}} dlffi_Function metatable */
 	/* {{{ dlffi_Pointer metatable */
@@ -967,6 +4580,86 @@ int luaopen_liblua_dlffi(lua_State *L) {
 	lua_settable(L, -3);
 	luaL_setfuncs(L, liblua_dlffi_Pointer_m, 0);
 	/* }}} dlffi_Pointer metatable */
+	/* {{{ dlffi_Struct metatable */
+	luaL_newmetatable(L, "dlffi_Struct");
+	lua_pushstring(L, "__index");
+	lua_pushcfunction(L, dlffi_Struct_index);
+	lua_settable(L, -3);
+	lua_pushstring(L, "__newindex");
+	lua_pushcfunction(L, dlffi_Struct_newindex);
+	lua_settable(L, -3);
+	/* }}} dlffi_Struct metatable */
+	/* {{{ dlffi_View metatable */
+	luaL_newmetatable(L, "dlffi_View");
+	lua_pushstring(L, "__index");
+	lua_pushvalue(L, -2);
+	lua_settable(L, -3);
+	lua_pushstring(L, "__len");
+	lua_pushcfunction(L, dlffi_View_len);
+	lua_settable(L, -3);
+	luaL_setfuncs(L, liblua_dlffi_View_m, 0);
+	/* }}} dlffi_View metatable */
+	/* {{{ dlffi_String metatable */
+	luaL_newmetatable(L, "dlffi_String");
+	lua_pushstring(L, "__index");
+	lua_pushvalue(L, -2);
+	lua_settable(L, -3);
+	lua_pushstring(L, "__len");
+	lua_pushcfunction(L, dlffi_String_len);
+	lua_settable(L, -3);
+	lua_pushstring(L, "__eq");
+	lua_pushcfunction(L, dlffi_String_eq);
+	lua_settable(L, -3);
+	lua_pushstring(L, "__lt");
+	lua_pushcfunction(L, dlffi_String_lt);
+	lua_settable(L, -3);
+	lua_pushstring(L, "__le");
+	lua_pushcfunction(L, dlffi_String_le);
+	lua_settable(L, -3);
+	lua_pushstring(L, "__tostring");
+	lua_pushcfunction(L, dlffi_String_tostring);
+	lua_settable(L, -3);
+	luaL_setfuncs(L, liblua_dlffi_String_m, 0);
+	/* }}} dlffi_String metatable */
+	/* {{{ dlffi_Library metatable */
+	luaL_newmetatable(L, "dlffi_Library");
+	lua_pushstring(L, "__index");
+	lua_pushvalue(L, -2);
+	lua_settable(L, -3);
+	lua_pushstring(L, "__gc");
+	lua_pushcfunction(L, dlffi_Library_gc);
+	lua_settable(L, -3);
+	luaL_setfuncs(L, liblua_dlffi_Library_m, 0);
+	/* }}} dlffi_Library metatable */
+	/* {{{ dlffi_Future metatable */
+	luaL_newmetatable(L, "dlffi_Future");
+	lua_pushstring(L, "__index");
+	lua_pushvalue(L, -2);
+	lua_settable(L, -3);
+	lua_pushstring(L, "__gc");
+	lua_pushcfunction(L, dlffi_Future_gc);
+	lua_settable(L, -3);
+	luaL_setfuncs(L, liblua_dlffi_Future_m, 0);
+	/* }}} dlffi_Future metatable */
+	/* {{{ dlffi_Arena metatable */
+	luaL_newmetatable(L, "dlffi_Arena");
+	lua_pushstring(L, "__index");
+	lua_pushvalue(L, -2);
+	lua_settable(L, -3);
+	lua_pushstring(L, "__close");
+	lua_pushcfunction(L, l_dlffi_Arena_reset);
+	lua_settable(L, -3);
+	lua_pushstring(L, "__gc");
+	lua_pushcfunction(L, dlffi_Arena_gc);
+	lua_settable(L, -3);
+	luaL_setfuncs(L, liblua_dlffi_Arena_m, 0);
+	/* }}} dlffi_Arena metatable */
+	/* {{{ dlffi_Queue metatable */
+	luaL_newmetatable(L, "dlffi_Queue");
+	lua_pushstring(L, "__gc");
+	lua_pushcfunction(L, dlffi_Queue_gc);
+	lua_settable(L, -3);
+	/* }}} dlffi_Queue metatable */
 	}
 	lua_newtable(L);
 	luaL_setfuncs(L, liblua_dlffi, 0);
@@ -1011,6 +4704,8 @@ int luaopen_liblua_dlffi(lua_State *L) {
 	lua_setfield(L, -2, "ffi_type_void");
 	lua_pushlightuserdata(L, &ffi_type_pointer);
 	lua_setfield(L, -2, "ffi_type_pointer");
+	lua_pushlightuserdata(L, &dlffi_type_cstring);
+	lua_setfield(L, -2, "ffi_type_cstring");
 	ffi_type *T_size_t = NULL;
 	switch (sizeof(size_t)) {
 	case 1:
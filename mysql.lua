@@ -10,29 +10,66 @@ local dl = require("dlffi");
 local mysql_t = dl.Dlffi_t:new(
 	"MYSQL_FIELD",
 	{
-		dl.ffi_type_pointer,	-- char *name
-		dl.ffi_type_pointer,	-- char *org_name
-		dl.ffi_type_pointer,	-- char *table
-		dl.ffi_type_pointer,	-- char *org_table
-		dl.ffi_type_pointer,	-- char *db
-		dl.ffi_type_pointer,	-- char *catalog
-		dl.ffi_type_pointer,	-- char *def
-		dl.ffi_type_ulong,	-- unsigned long length
-		dl.ffi_type_ulong,	-- unsigned long max_length
-		dl.ffi_type_uint,	-- unsigned int name_length
-		dl.ffi_type_uint,	-- unsigned int org_name_length
-		dl.ffi_type_uint,	-- unsigned int table_length
-		dl.ffi_type_uint,	-- unsigned int org_table_length
-		dl.ffi_type_uint,	-- unsigned int db_length
-		dl.ffi_type_uint,	-- unsigned int catalog_length
-		dl.ffi_type_uint,	-- unsigned int def_length
-		dl.ffi_type_uint,	-- unsigned int flags
-		dl.ffi_type_uint,	-- unsigned int decimals
-		dl.ffi_type_uint,	-- unsigned int charsetnr
-		dl.ffi_type_uint,	-- enum enum_field_types type
-		dl.ffi_type_pointer,	-- void *extension
+		{ "name", dl.ffi_type_pointer },	-- char *
+		{ "org_name", dl.ffi_type_pointer },	-- char *
+		{ "table", dl.ffi_type_pointer },	-- char *
+		{ "org_table", dl.ffi_type_pointer },	-- char *
+		{ "db", dl.ffi_type_pointer },	-- char *
+		{ "catalog", dl.ffi_type_pointer },	-- char *
+		{ "def", dl.ffi_type_pointer },	-- char *
+		{ "length", dl.ffi_type_ulong },	-- unsigned long
+		{ "max_length", dl.ffi_type_ulong },	-- unsigned long
+		{ "name_length", dl.ffi_type_uint },	-- unsigned int
+		{ "org_name_length", dl.ffi_type_uint },	-- unsigned int
+		{ "table_length", dl.ffi_type_uint },	-- unsigned int
+		{ "org_table_length", dl.ffi_type_uint },	-- unsigned int
+		{ "db_length", dl.ffi_type_uint },	-- unsigned int
+		{ "catalog_length", dl.ffi_type_uint },	-- unsigned int
+		{ "def_length", dl.ffi_type_uint },	-- unsigned int
+		{ "flags", dl.ffi_type_uint },	-- unsigned int
+		{ "decimals", dl.ffi_type_uint },	-- unsigned int
+		{ "charsetnr", dl.ffi_type_uint },	-- unsigned int
+		{ "type", dl.ffi_type_uint },	-- enum enum_field_types
+		{ "extension", dl.ffi_type_pointer },	-- void *
 	}
 );
+-- MySQL 5.7 and 8.0 layout, my_bool is char
+mysql_t["MYSQL_BIND"] = {
+	{ "length", dl.ffi_type_pointer },	-- unsigned long *
+	{ "is_null", dl.ffi_type_pointer },	-- my_bool *
+	{ "buffer", dl.ffi_type_pointer },	-- void *
+	{ "error", dl.ffi_type_pointer },	-- my_bool *
+	{ "row_ptr", dl.ffi_type_pointer },	-- unsigned char *
+	{ "store_param_func", dl.ffi_type_pointer },
+	{ "fetch_result", dl.ffi_type_pointer },
+	{ "skip_result", dl.ffi_type_pointer },
+	{ "buffer_length", dl.ffi_type_ulong },	-- unsigned long
+	{ "offset", dl.ffi_type_ulong },	-- unsigned long
+	{ "length_value", dl.ffi_type_ulong },	-- unsigned long
+	{ "param_number", dl.ffi_type_uint },	-- unsigned int
+	{ "pack_length", dl.ffi_type_uint },	-- unsigned int
+	{ "buffer_type", dl.ffi_type_uint },	-- enum enum_field_types
+	{ "error_value", dl.ffi_type_uchar },	-- my_bool
+	{ "is_unsigned", dl.ffi_type_uchar },	-- my_bool
+	{ "long_data_used", dl.ffi_type_uchar },	-- my_bool
+	{ "is_null_value", dl.ffi_type_uchar },	-- my_bool
+	{ "extension", dl.ffi_type_pointer },	-- void *
+};
+-- value buffers of the binds
+mysql_t["integer"] = { { "value", dl.ffi_type_sint64 } };
+mysql_t["unsigned"] = { { "value", dl.ffi_type_uint64 } };
+mysql_t["double"] = { { "value", dl.ffi_type_double } };
+mysql_t["length"] = { { "value", dl.ffi_type_ulong } };
+mysql_t["bool"] = { { "value", dl.ffi_type_uchar } };
+
+-- enum enum_field_types
+local MYSQL_TYPE = {
+	TINY = 1, SHORT = 2, LONG = 3, FLOAT = 4, DOUBLE = 5, NULL = 6,
+	LONGLONG = 8, INT24 = 9, YEAR = 13, STRING = 254,
+};
+local MYSQL_NO_DATA = 100;
+local MYSQL_DATA_TRUNCATED = 101;
+local UNSIGNED_FLAG = 32;
 
 local mysql = {
 {
@@ -168,6 +205,111 @@ local mysql = {
 		dl.ffi_type_pointer,	-- obj
 	}
 },
+{
+	"stmt_init",
+	dl.ffi_type_pointer,
+	{
+		dl.ffi_type_pointer,	-- obj
+	}
+},
+{
+	"stmt_prepare",
+	dl.ffi_type_sint,
+	{
+		dl.ffi_type_pointer,	-- stmt
+		dl.ffi_type_pointer,	-- query
+		dl.ffi_type_ulong,	-- length
+	}
+},
+{
+	"stmt_param_count",
+	dl.ffi_type_ulong,
+	{
+		dl.ffi_type_pointer,	-- stmt
+	}
+},
+{
+	"stmt_field_count",
+	dl.ffi_type_uint,
+	{
+		dl.ffi_type_pointer,	-- stmt
+	}
+},
+{
+	"stmt_bind_param",
+	dl.ffi_type_uchar,
+	{
+		dl.ffi_type_pointer,	-- stmt
+		dl.ffi_type_pointer,	-- bind
+	}
+},
+{
+	"stmt_bind_result",
+	dl.ffi_type_uchar,
+	{
+		dl.ffi_type_pointer,	-- stmt
+		dl.ffi_type_pointer,	-- bind
+	}
+},
+{
+	"stmt_execute",
+	dl.ffi_type_sint,
+	{
+		dl.ffi_type_pointer,	-- stmt
+	}
+},
+{
+	"stmt_fetch",
+	dl.ffi_type_sint,
+	{
+		dl.ffi_type_pointer,	-- stmt
+	}
+},
+{
+	"stmt_fetch_column",
+	dl.ffi_type_sint,
+	{
+		dl.ffi_type_pointer,	-- stmt
+		dl.ffi_type_pointer,	-- bind
+		dl.ffi_type_uint,	-- column
+		dl.ffi_type_ulong,	-- offset
+	}
+},
+{
+	"stmt_result_metadata",
+	dl.ffi_type_pointer,
+	{
+		dl.ffi_type_pointer,	-- stmt
+	}
+},
+{
+	"stmt_affected_rows",
+	dl.ffi_type_uint64,
+	{
+		dl.ffi_type_pointer,	-- stmt
+	}
+},
+{
+	"stmt_insert_id",
+	dl.ffi_type_uint64,
+	{
+		dl.ffi_type_pointer,	-- stmt
+	}
+},
+{
+	"stmt_error",
+	dl.ffi_type_pointer,
+	{
+		dl.ffi_type_pointer,	-- stmt
+	}
+},
+{
+	"stmt_close",
+	dl.ffi_type_uchar,
+	{
+		dl.ffi_type_pointer,	-- stmt
+	}
+},
 {
 	"autocommit",
 	dl.ffi_type_sint,
@@ -251,11 +393,17 @@ function Mysql:query(stmt, use_result)
 end;
 -- }}} Mysql:query
 
--- {{{ char * Mysql:real_escape_string(char *)
-function Mysql:real_escape_string(stmt)
+-- {{{ char * Mysql:real_escape_string(char *[, arena])
+--	arena	- optional dl.arena() for the escape buffer
+function Mysql:real_escape_string(stmt, arena)
 	-- override mysql_real_escape_string()
 	if not stmt then return "" end;
-	local buf = dl.dlffi_Pointer(1 + 2 * #stmt, true);
+	local buf;
+	if arena then
+		buf = arena:alloc(1 + 2 * #stmt, 1);
+	else
+		buf = dl.dlffi_Pointer(1 + 2 * #stmt, true);
+	end;
 	if buf == nil then return nil, "dlffi_Pointer() failed" end;
 	local r = mysql.real_escape_string(
 		self,
@@ -268,6 +416,134 @@ function Mysql:real_escape_string(stmt)
 end;
 -- }}} Mysql:real_escape_string
 
+-- {{{ Mysql:insert(char *, table[, number])
+--[[
+	execute multi-row INSERT statements for an array of rows
+	prefix	- statement up to the values, e.g. "INSERT INTO t (a, b) VALUES "
+	rows	- array of arrays of values: strings are escaped, finite
+		numbers and booleans are written as they are, dl.NULL is NULL;
+		a row with the field n, as made by table.pack(), has n
+		columns and its nil values are NULL too
+	max	- statement size limit, max_allowed_packet of the server;
+		1 MiB by default
+	values are escaped straight into one native buffer reused by the
+	connection, statements are never built as Lua strings
+	Return: number of affected rows, or nil and error message
+--]]
+function Mysql:insert(prefix, rows, max)
+	max = max or 1048576;
+	local buf = rawget(self, "_insert_buf");
+	local cap = rawget(self, "_insert_cap") or 0;
+	if not buf then
+		cap = math.max(4096, 2 * #prefix);
+		buf = dl.dlffi_Pointer(cap, true);
+		if not buf then return nil, "dlffi_Pointer() failed" end;
+		rawset(self, "_insert_buf", buf);
+		rawset(self, "_insert_cap", cap);
+	end;
+	-- {{{ reserve() - make room for n more bytes after pos
+	local function reserve(pos, n)
+		if pos + n <= cap then return true end;
+		local size = cap;
+		while size < pos + n do size = size * 2 end;
+		local r, e = buf:realloc(size);
+		if not r then return nil, e end;
+		cap = size;
+		rawset(self, "_insert_cap", cap);
+		return true;
+	end;
+	-- }}} reserve()
+	-- {{{ columns() - number of values in the row, nil if invalid
+	local function columns(row)
+		local n = row.n or #row;
+		for j = 1, n, 1 do
+			local v = row[j];
+			local t = type(v);
+			if (t == "number") and ((v ~= v) or (v == math.huge) or
+				(v == -math.huge)) then
+				return nil, "non-finite number";
+			elseif (t ~= "string") and (t ~= "number") and
+				(t ~= "boolean") and (v ~= nil) and (v ~= dl.NULL) then
+				return nil, "unsupported value type " .. t;
+			end;
+		end;
+		return n;
+	end;
+	-- }}} columns()
+	-- nothing is sent unless all the rows are valid
+	local ncols = {};
+	for i = 1, #rows, 1 do
+		local n, e = columns(rows[i]);
+		if not n then
+			return nil, string.format("%s in row #%d", e, i);
+		end;
+		ncols[i] = n;
+	end;
+	local total = 0;
+	local pos, count = 0, 0;
+	-- {{{ flush() - execute the statement built so far
+	local function flush()
+		if count == 0 then return true end;
+		local r = self:real_query(buf, pos);
+		if tonumber(r) ~= 0 then
+			return nil, dl.dlffi_Pointer(self:error()):tostring();
+		end;
+		total = total + tonumber(self:affected_rows());
+		pos, count = 0, 0;
+		return true;
+	end;
+	-- }}} flush()
+	local ok, e = reserve(0, #prefix);
+	if not ok then return nil, e end;
+	for i = 1, #rows, 1 do
+		local row = rows[i];
+		-- the upper bound of the escaped row size
+		local size = 3;
+		for j = 1, ncols[i], 1 do
+			local v = row[j];
+			if type(v) == "string" then size = size + 2 * #v + 3;
+			else size = size + 32 end;
+		end;
+		if (count > 0) and (pos + size > max) then
+			ok, e = flush();
+			if not ok then return nil, e end;
+		end;
+		ok, e = reserve(pos, #prefix + size);
+		if not ok then return nil, e end;
+		if count == 0 then
+			pos = buf:write(0, prefix);
+			pos = buf:write(pos, "(");
+		else
+			pos = buf:write(pos, ",(");
+		end;
+		for j = 1, ncols[i], 1 do
+			local v = row[j];
+			if j > 1 then pos = buf:write(pos, ",") end;
+			if type(v) == "string" then
+				pos = buf:write(pos, "'");
+				pos = pos + tonumber(mysql.real_escape_string(
+					self, buf:offset(pos), v, #v
+				));
+				pos = buf:write(pos, "'");
+			elseif math.type(v) == "float" then
+				pos = buf:write(pos, string.format("%.17g", v));
+			elseif type(v) == "number" then
+				pos = buf:write(pos, tostring(v));
+			elseif type(v) == "boolean" then
+				pos = buf:write(pos, v and "1" or "0");
+			else
+				pos = buf:write(pos, "NULL");
+			end;
+		end;
+		pos = buf:write(pos, ")");
+		count = count + 1;
+	end;
+	ok, e = flush();
+	if not ok then return nil, e end;
+	return total;
+end;
+-- }}} Mysql:insert
+
 -- {{{ Mysql:fetch_assoc()
 function Mysql:fetch_assoc()
 	-- self envelops (MYSQL_RES *) here!
@@ -294,7 +570,7 @@ function Mysql:fetch_assoc()
 			dl.type_element(
 				struct,
 				mysql_t["MYSQL_FIELD"],
-				1
+				"name"
 			)
 		);
 		if name == nil then
@@ -337,5 +613,281 @@ function Mysql:fetch_assoc()
 end;
 -- }}} Mysql:fetch_assoc
 
+-- {{{ Mysql:rows([reuse])
+--[[
+	iterator over the rows of the result as Mysql:fetch_assoc() returns
+	them; column names are read once, NULL values are nil
+	reuse	- fill the same table for every row
+	returns nil and an error message instead of the iterator on failure
+--]]
+function Mysql:rows(reuse)
+	-- self envelops (MYSQL_RES *) here!
+	local num = self:num_fields();
+	if num == nil then return nil, "mysql_num_fields() failed" end;
+	num = tonumber(num);
+	local fields = self:fetch_fields();
+	if (not fields) or (fields == dl.NULL) then
+		return nil, "mysql_fetch_fields() failed";
+	end;
+	local meta = dl.type_decode(fields, mysql_t["MYSQL_FIELD"], num, true);
+	local names = {};
+	for i = 1, num, 1 do
+		names[i] = dl.dlffi_Pointer(meta.name[i]):tostring(
+			meta.name_length[i]
+		);
+	end;
+	-- views are pointed to each row and its lengths in turn
+	local values, lengths;
+	local out = reuse and {} or nil;
+	return function()
+		local row = self:fetch_row();
+		if (not row) or (row == dl.NULL) then return nil end;
+		local len = self:fetch_lengths();
+		if (not len) or (len == dl.NULL) then
+			return nil, "mysql_fetch_lengths() failed";
+		end;
+		if values then
+			values:rebind(row);
+			lengths:rebind(len);
+		else
+			values = dl.dlffi_Pointer(row):view(
+				dl.ffi_type_pointer, num
+			);
+			lengths = dl.dlffi_Pointer(len):view(
+				dl.ffi_type_ulong, num
+			);
+		end;
+		return values:tostrings(lengths, 1, num, names, out);
+	end;
+end;
+-- }}} Mysql:rows
+
+-- {{{ Stmt - prepared statement
+local Stmt = { _type = "object" };
+-- MYSQL_STMT functions without "stmt_" prefix
+local mysql_stmt = {};
+for k, v in pairs(mysql) do
+	local name = type(k) == "string" and k:match("^stmt_(.+)$");
+	if name then mysql_stmt[name] = v end;
+end;
+
+-- {{{ binds() - array of n MYSQL_BIND with a struct view per element
+local function binds(n)
+	-- encoding empty rows zeroes the array
+	local empty = {};
+	for i = 1, n, 1 do empty[i] = {} end;
+	local buf = mysql_t:encode("MYSQL_BIND", empty);
+	if not buf then return nil end;
+	local views = {};
+	for i = 1, n, 1 do
+		views[i] = mysql_t:view("MYSQL_BIND",
+			buf:index(i, mysql_t["MYSQL_BIND"]));
+	end;
+	return buf, views;
+end;
+-- }}} binds()
+
+-- {{{ Stmt * Mysql:prepare(char *)
+--[[
+	MYSQL_BIND arrays and value buffers are allocated once
+	per statement and rebound on every execution
+--]]
+function Mysql:prepare(query)
+	local o, e = dl.Dlffi:new(
+		{ Stmt, mysql_stmt },
+		mysql.stmt_init(self),
+		mysql.stmt_close
+	);
+	if not o then return nil, e end;
+	-- the connection must outlive its statements
+	o.conn = self;
+	if o:prepare(query, #query) ~= 0 then return nil, o:errmsg() end;
+	local n = tonumber(o:param_count());
+	o.nparams = n;
+	o.params, o.param_views = binds(n);
+	o.values = dl.dlffi_Pointer(math.max(8 * n, 1), true);
+	o.integers, o.doubles, o.bools = {}, {}, {};
+	for i = 1, n, 1 do
+		local p = o.values:index(i, mysql_t["integer"]);
+		o.integers[i] = mysql_t:view("integer", p);
+		o.doubles[i] = mysql_t:view("double", p);
+		o.bools[i] = mysql_t:view("bool", p);
+	end;
+	o.arena = dl.arena(1024);
+	return o;
+end;
+-- }}} Mysql:prepare
+
+-- {{{ Stmt:errmsg() - last error message
+function Stmt:errmsg()
+	return dl.dlffi_Pointer(mysql.stmt_error(self)):tostring();
+end;
+-- }}} Stmt:errmsg()
+
+-- {{{ Stmt:bind_results() - prepare result buffers once
+function Stmt:bind_results()
+	local n = tonumber(self:field_count());
+	local res = mysql.stmt_result_metadata(self);
+	if (not res) or (res == dl.NULL) then return nil end;
+	local meta = dl.type_decode(mysql.fetch_fields(res),
+		mysql_t["MYSQL_FIELD"], n, true);
+	local names, kinds, unsigned = {}, {}, {};
+	for i = 1, n, 1 do
+		names[i] = dl.dlffi_Pointer(meta.name[i]):tostring(
+			meta.name_length[i]
+		);
+		local t = meta.type[i];
+		if (t == MYSQL_TYPE.TINY) or (t == MYSQL_TYPE.SHORT) or
+			(t == MYSQL_TYPE.LONG) or (t == MYSQL_TYPE.INT24) or
+			(t == MYSQL_TYPE.LONGLONG) or (t == MYSQL_TYPE.YEAR) then
+			kinds[i] = MYSQL_TYPE.LONGLONG;
+		elseif (t == MYSQL_TYPE.FLOAT) or (t == MYSQL_TYPE.DOUBLE) then
+			kinds[i] = MYSQL_TYPE.DOUBLE;
+		else
+			kinds[i] = MYSQL_TYPE.STRING;
+		end;
+		unsigned[i] = (meta.flags[i] & UNSIGNED_FLAG) ~= 0;
+	end;
+	mysql.free_result(res);
+	local buf, views = binds(n);
+	-- strings longer than this are fetched again with fetch_column()
+	local width = 256;
+	local lengths = dl.dlffi_Pointer(math.max(n * 8, 1), true);
+	local nulls = dl.dlffi_Pointer(math.max(n, 1), true);
+	local buffers, numbers = {}, {};
+	for i = 1, n, 1 do
+		local v = views[i];
+		buffers[i] = dl.dlffi_Pointer(width, true);
+		local t = "integer";
+		if kinds[i] == MYSQL_TYPE.DOUBLE then
+			t = "double";
+		elseif unsigned[i] then
+			t = "unsigned";
+		end;
+		numbers[i] = mysql_t:view(t, buffers[i]);
+		v.buffer_type = kinds[i];
+		v.buffer = buffers[i];
+		v.buffer_length = width;
+		v.is_unsigned = unsigned[i] and 1 or 0;
+		v.length = lengths:index(i, mysql_t["length"]);
+		v.is_null = nulls:index(i, mysql_t["bool"]);
+	end;
+	if mysql.stmt_bind_result(self, buf) ~= 0 then
+		return nil, self:errmsg();
+	end;
+	-- a single bind and buffer fetch truncated strings again
+	local refetch, refetch_views = binds(1);
+	refetch_views[1].buffer_type = MYSQL_TYPE.STRING;
+	self.results = {
+		binds = buf, views = views, names = names, kinds = kinds,
+		unsigned = unsigned, width = width, buffers = buffers,
+		numbers = numbers, lengths = lengths:view(dl.ffi_type_ulong, n),
+		nulls = nulls:view(dl.ffi_type_uchar, n), n = n,
+		lens = {}, isnull = {},
+		refetch = refetch, refetch_view = refetch_views[1],
+		long = dl.dlffi_Pointer(width, true), long_size = width,
+	};
+	return self.results;
+end;
+-- }}} Stmt:bind_results()
+
+-- {{{ Stmt:execute(...) - bind the values and execute
+--	integers, floats, booleans (as TINY 1 or 0), strings and nil are
+--	bound in place
+--	Return: number of affected rows, or nil and error message
+function Stmt:execute(...)
+	local n = self.nparams;
+	if select("#", ...) ~= n then
+		return nil, string.format("%d parameters expected", n);
+	end;
+	self.arena:reset();
+	for i = 1, n, 1 do
+		local v = select(i, ...);
+		local b = self.param_views[i];
+		local t = math.type(v);
+		-- the bind may hold the length of a string of the last call
+		b.buffer_length = 0;
+		if t == "integer" then
+			self.integers[i].value = v;
+			b.buffer_type = MYSQL_TYPE.LONGLONG;
+			b.buffer = self.integers[i];
+		elseif t == "float" then
+			self.doubles[i].value = v;
+			b.buffer_type = MYSQL_TYPE.DOUBLE;
+			b.buffer = self.doubles[i];
+		elseif type(v) == "boolean" then
+			self.bools[i].value = v and 1 or 0;
+			b.buffer_type = MYSQL_TYPE.TINY;
+			b.buffer = self.bools[i];
+		elseif v == nil then
+			b.buffer_type = MYSQL_TYPE.NULL;
+			b.buffer = dl.NULL;
+		else
+			local p, len = self.arena:string(tostring(v));
+			b.buffer_type = MYSQL_TYPE.STRING;
+			b.buffer = p;
+			b.buffer_length = len;
+		end;
+	end;
+	if mysql.stmt_bind_param(self, self.params) ~= 0 then
+		return nil, self:errmsg();
+	end;
+	if mysql.stmt_execute(self) ~= 0 then return nil, self:errmsg() end;
+	if (not self.results) and (tonumber(self:field_count()) > 0) then
+		local r, e = self:bind_results();
+		if not r then return nil, e end;
+	end;
+	return self:affected_rows();
+end;
+-- }}} Stmt:execute(...)
+
+-- {{{ Stmt:fetch([table]) - next row keyed by column names
+--	integer and real columns are Lua numbers, NULL is nil; UNSIGNED
+--	BIGINT values above math.maxinteger are floats
+--	Return: row, nil at the end of the result, or nil and error message
+function Stmt:fetch(row)
+	local r = self.results;
+	if not r then return nil, "statement has no result" end;
+	local rc = mysql.stmt_fetch(self);
+	if rc == MYSQL_NO_DATA then return nil end;
+	if (rc ~= 0) and (rc ~= MYSQL_DATA_TRUNCATED) then
+		return nil, self:errmsg();
+	end;
+	row = row or {};
+	local lens = r.lengths:read(1, r.n, r.lens);
+	local isnull = r.nulls:read(1, r.n, r.isnull);
+	for i = 1, r.n, 1 do
+		local v;
+		if isnull[i] ~= 0 then
+			v = nil;
+		elseif r.kinds[i] ~= MYSQL_TYPE.STRING then
+			v = r.numbers[i].value;
+			-- uint64_t wraps around to a negative Lua integer
+			if r.unsigned[i] and (v < 0) then v = v + 2.0 ^ 64 end;
+		elseif lens[i] <= r.width then
+			v = r.buffers[i]:tostring(lens[i]);
+		else
+			-- truncated: fetch the whole value into the refetch bind,
+			-- its buffer grows to the longest value
+			if lens[i] > r.long_size then
+				local ok, e = r.long:realloc(lens[i]);
+				if not ok then return nil, e end;
+				r.long_size = lens[i];
+			end;
+			local b = r.refetch_view;
+			b.buffer = r.long;
+			b.buffer_length = lens[i];
+			if mysql.stmt_fetch_column(self, r.refetch, i - 1, 0) ~= 0 then
+				return nil, self:errmsg();
+			end;
+			v = r.long:tostring(lens[i]);
+		end;
+		row[r.names[i]] = v;
+	end;
+	return row;
+end;
+-- }}} Stmt:fetch([table])
+-- }}} Stmt
+
 return { ["Mysql"] = Mysql, ["mysql_t"] = mysql_t, ["dl"] = dl, ["mysql"] = mysql };
 
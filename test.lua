@@ -1,15 +1,781 @@
 #!/usr/bin/env lua
 
 --[[
-	assume the MySQL server is running on localhost:3306
+	the checks of dlffi call libc and libm only and run first,
+	mysql.lua is checked against a mock of libmysqlclient there;
+	"lua test.lua dlffi" stops after them;
+	then assume the MySQL server is running on localhost:3306
 	and user "test" with password "mypas" is granted any
 	privileges on database "test";
 	feel free to modify real_connect()'s parameters to
 	fit the sample code for your very case;
 --]]
 
-local mysql = require("mysql");
-assert(type(mysql) == "table", "MySQL module loading error");
+local dl = require("dlffi");
+assert(type(dl) == "table", "dlffi module loading error");
+local LIBC, LIBM = "libc.so.6", "libm.so.6";
+local mysql;
+
+-- {{{ dlffi checks
+-- list of { name, function }, each function asserts its feature
+local checks = {};
+
+-- {{{ plans - conversions of the argument and return values
+table.insert(checks, { "plans", function()
+	local I, L, D = dl.ffi_type_sint, dl.ffi_type_slong, dl.ffi_type_double;
+	local abs = assert(dl.load(LIBC, "abs", I, { I }));
+	assert(abs(-7) == 7);
+	local llabs = assert(dl.load(LIBC, "llabs",
+		dl.ffi_type_sint64, { dl.ffi_type_sint64 }));
+	assert(llabs(-(1 << 40)) == 1 << 40);
+	local labs = assert(dl.load(LIBC, "labs", L, { L }));
+	assert(labs(math.mininteger + 1) == math.maxinteger);
+	local fabsf = assert(dl.load(LIBM, "fabsf",
+		dl.ffi_type_float, { dl.ffi_type_float }));
+	assert(fabsf(-2.5) == 2.5);
+	local ldexp = assert(dl.load(LIBM, "ldexp", D, { D, I }));
+	assert(ldexp(0.75, 4) == 12.0);
+	local strlen = assert(dl.load(LIBC, "strlen",
+		dl.ffi_type_size_t, { dl.ffi_type_pointer }));
+	assert(strlen("hello") == 5);
+	assert(strlen("") == 0);
+	local atof = assert(dl.load(LIBC, "atof", D, { dl.ffi_type_pointer }));
+	assert(atof("-1.25") == -1.25);
+	-- booleans are integers, tables are cast by their _val field
+	assert(abs(true) == 1);
+	assert(abs({ _val = -3 }) == 3);
+	-- errors are returned
+	local r, e = abs(1, 2);
+	assert((r == nil) and e:find("2 arguments"), e);
+	r, e = abs({});
+	assert((r == nil) and e, "a table without _val is refused");
+	r, e = strlen(function() end);
+	assert((r == nil) and e, "a function is not a pointer");
+end });
+-- }}} plans
+
+-- {{{ batch - one call per row of argument columns
+table.insert(checks, { "batch", function()
+	local I = dl.ffi_type_sint;
+	local abs = assert(dl.load(LIBC, "abs", I, { I }));
+	local ldexp = assert(dl.load(LIBM, "ldexp",
+		dl.ffi_type_double, { dl.ffi_type_double, I }));
+	-- Lua arrays and constants
+	local t = assert(dl.batch(abs, 3, nil, { -1, 2, -3 }));
+	assert((#t == 3) and (t[1] == 1) and (t[3] == 3));
+	t = assert(dl.batch(ldexp, 2, nil, { 1.0, 0.5 }, 3));
+	assert((t[1] == 8.0) and (t[2] == 4.0));
+	t = assert(abs:map({ -5, 6 }));
+	assert((#t == 2) and (t[1] == 5) and (t[2] == 6));
+	-- packed buffers in and out
+	local inb = dl.dlffi_Pointer(4 * dl.sizeof(I), true);
+	inb:view(I, 4):write(1, { -1, -2, 3, -4 });
+	local outb = dl.dlffi_Pointer(4 * dl.sizeof(I), true);
+	assert(dl.batch(abs, 4, outb, inb) == 4);
+	t = outb:view(I, 4):read();
+	assert((t[1] == 1) and (t[2] == 2) and (t[3] == 3) and (t[4] == 4));
+	t = assert(dl.batch(abs, 2, nil, outb:view(I, 4)));
+	assert((t[1] == 1) and (t[2] == 2));
+	-- columns and buffers shorter than the rows
+	local r, e = dl.batch(abs, 4, nil, { 1, 2 });
+	assert((r == nil) and e:find("shorter"), e);
+	r, e = dl.batch(abs, 5, nil, inb);
+	assert((r == nil) and e:find("shorter"), e);
+	r, e = dl.batch(abs, 5, nil, inb:view(I, 4));
+	assert((r == nil) and e:find("shorter"), e);
+	r, e = dl.batch(abs, 1, nil, dl.dlffi_Pointer(inb:offset(0)));
+	assert((r == nil) and e:find("unknown length"), e);
+	r, e = dl.batch(abs, 1, nil, inb:view(dl.ffi_type_double, 2));
+	assert((r == nil) and e:find("element size"), e);
+	assert(not pcall(dl.batch, abs, 5, outb, { 1, 2, 3, 4, 5 }));
+	r, e = abs:map(1);
+	assert((r == nil) and e, "map() needs a Lua array");
+end });
+-- }}} batch
+
+-- {{{ lazy - Header.loadlib() binding symbols on the first access
+table.insert(checks, { "lazy", function()
+	local I = dl.ffi_type_sint;
+	local header = {
+		["_dlffi"] = { ["lib"] = { LIBC } },
+		{
+			["_dlffi"] = { ["prefix"] = "str", ["glue"] = "" },
+			{ "len", dl.ffi_type_size_t, { dl.ffi_type_pointer } },
+			{ "cmp", I, { dl.ffi_type_pointer, dl.ffi_type_pointer } },
+		},
+		{
+			{ "abs", I, { I } },
+			{ "no_such_symbol_in_libc", I, { I } },
+		},
+	};
+	local lib = assert(dl.Header.loadlib(header, nil, true));
+	local bound, total = dl.Header.lazy_stats(lib);
+	assert((bound == 0) and (total == 4));
+	assert(lib.str.len("four") == 4);
+	-- the long name is the same function
+	assert(lib[""].strlen == lib.str.len);
+	assert(lib[""].abs(-2) == 2);
+	bound, total = dl.Header.lazy_stats(lib);
+	assert((bound == 2) and (total == 4));
+	-- a missing symbol fails on its first access only
+	assert(not pcall(function() return lib[""].no_such_symbol_in_libc end));
+	-- eager loading fails at once
+	local r, e = dl.Header.loadlib(header);
+	assert((r == nil) and e:find("no_such_symbol_in_libc"), e);
+end });
+-- }}} lazy
+
+-- {{{ struct - layouts and elements accessed by names
+table.insert(checks, { "struct", function()
+	local I, D = dl.ffi_type_sint, dl.ffi_type_double;
+	local T = assert(dl.Dlffi_t:new("pt", {
+		{ "x", I },
+		{ "y", D },
+	}));
+	T["div_t"] = { { "quot", I }, { "rem", I } };
+	assert(dl.sizeof(T.pt) == 16);
+	assert((dl.type_offset(T.pt, "x") == 0) and
+		(dl.type_offset(T.pt, "y") == 8) and
+		(dl.type_offset(T.pt, 2) == 8));
+	assert(dl.type_offset(T.pt, "z") == nil);
+	assert(dl.type_offset(T.pt, 3) == nil);
+	local buf = assert(T:new("pt", true));
+	assert(T:put("pt", buf, "x", 7) and T:put("pt", buf, 2, 0.5));
+	assert((T:get("pt", buf, 1) == 7) and (T:get("pt", buf, "y") == 0.5));
+	local v = assert(T:view("pt", buf));
+	assert((v.x == 7) and (v.y == 0.5));
+	v.x = -1;
+	assert(T:get("pt", buf, "x") == -1);
+	assert(v.z == nil);
+	assert(not pcall(function() v.z = 1 end));
+	assert(not pcall(function() v.x = "not a number" end));
+	-- views are passed as pointers
+	local copy = assert(T:new("pt", true));
+	local memcpy = assert(dl.load(LIBC, "memcpy", dl.ffi_type_pointer,
+		{ dl.ffi_type_pointer, dl.ffi_type_pointer, dl.ffi_type_size_t }));
+	memcpy(copy, v, dl.sizeof(T.pt));
+	assert(T:view("pt", copy).x == -1);
+	-- structures returned by value
+	local div = assert(dl.load(LIBC, "div", T.div_t, { I, I }));
+	local q = T:view("div_t", div(17, 5));
+	assert((q.quot == 3) and (q.rem == 2));
+end });
+-- }}} struct
+
+-- {{{ codec - encoding and decoding arrays of structures
+table.insert(checks, { "codec", function()
+	local I, P = dl.ffi_type_sint, dl.ffi_type_pointer;
+	local T = assert(dl.Dlffi_t:new("rec", {
+		{ "id", I },
+		{ "name", P },
+	}));
+	local buf, n = assert(T:encode("rec", {
+		{ id = 1, name = "one" },
+		{ id = 2 },
+		{ name = "three" },
+	}));
+	assert(n == 3);
+	collectgarbage();
+	local rows = T:decode("rec", buf, n);
+	assert((rows[1].id == 1) and (rows[2].id == 2) and (rows[3].id == 0));
+	assert(dl.dlffi_Pointer(rows[1].name):tostring() == "one");
+	assert((rows[2].name == dl.NULL) and
+		(dl.dlffi_Pointer(rows[3].name):tostring() == "three"));
+	local cols = T:decode("rec", buf, n, true);
+	assert((#cols.id == 3) and (cols.id[2] == 2));
+	buf, n = assert(T:encode("rec", { id = { 5, 6 } }, true));
+	assert((n == 2) and (T:decode("rec", buf, 2)[2].id == 6));
+	-- strings need an arena, the failed element is left zeroed
+	local raw = dl.dlffi_Pointer(2 * dl.sizeof(T.rec), true);
+	local r, e = dl.type_encode(raw, T.rec, {
+		{ id = 1, name = dl.NULL }, { id = 2, name = "two" },
+	});
+	assert((r == nil) and e:find("no arena"), e);
+	assert(T:decode("rec", raw, 2)[2].name == dl.NULL);
+	r, e = dl.type_encode(raw, T.rec, { { id = {} } });
+	assert((r == nil) and e:find("element #1 of row #1"), e);
+	assert(not pcall(dl.type_encode, dl.NULL, T.rec, { {} }));
+end });
+-- }}} codec
+
+-- {{{ view - typed arrays over dlffi_Pointer
+table.insert(checks, { "view", function()
+	local I, P = dl.ffi_type_sint, dl.ffi_type_pointer;
+	local buf = dl.dlffi_Pointer(4 * dl.sizeof(I), true);
+	local v = assert(buf:view(I, 4));
+	assert(#v == 4);
+	assert(v:write(1, { 10, 20, 30, 40 }) == 4);
+	assert(v:write(3, { -3 }) == 1);
+	local t = v:read();
+	assert((#t == 4) and (t[1] == 10) and (t[3] == -3) and (t[4] == 40));
+	t = v:read(2, 3, { "kept" });
+	assert((t[1] == 20) and (t[2] == -3));
+	assert(#v:read(3, 2) == 0);
+	assert(not pcall(v.read, v, 0));
+	assert(not pcall(v.read, v, 1, 5));
+	assert(not pcall(v.write, v, 4, { 1, 2 }));
+	local r, e = v:write(1, { "x" });
+	assert((r == nil) and e:find("element #1"), e);
+	-- views follow reallocated memory
+	assert(buf:realloc(1024));
+	assert(v:read(4, 4)[1] == 40);
+	-- arrays of strings
+	local sv = assert(dl.dlffi_Pointer(3 * dl.sizeof(P), true):view(P, 3));
+	r, e = sv:write(1, { "no arena" });
+	assert((r == nil) and e:find("no arena"), e);
+	assert(sv:write(1, { "ab", dl.NULL, "cdef" }, dl.arena()) == 3);
+	collectgarbage();
+	t = sv:tostrings();
+	assert((t[1] == "ab") and (t[2] == false) and (t[3] == "cdef"));
+	t = sv:tostrings(1);
+	assert((t[1] == "a") and (t[3] == "c"));
+	t = sv:tostrings({ 2, 0, 3 }, 1, 3, { "a", "b", "c" });
+	assert((t.a == "ab") and (t.b == nil) and (t.c == "cde"));
+	-- rebinding and released memory
+	local other = dl.dlffi_Pointer(4 * dl.sizeof(I), true);
+	other:view(I, 4):write(1, { 1, 2, 3, 4 });
+	v:rebind(other);
+	assert(v:read(2, 2)[1] == 2);
+	assert(not pcall(v.rebind, v, dl.NULL));
+	getmetatable(other).__gc(other);
+	assert(not pcall(v.read, v));
+end });
+-- }}} view
+
+-- {{{ queue - closures called by foreign threads
+table.insert(checks, { "queue", function()
+	local I, P, S = dl.ffi_type_sint, dl.ffi_type_pointer, dl.ffi_type_size_t;
+	local qsort = assert(dl.load(LIBC, "qsort",
+		dl.ffi_type_void, { P, S, S, P }));
+	local function int(p)
+		return dl.dlffi_Pointer(p, false):view(I, 1):read()[1];
+	end;
+	local calls = 0;
+	local cmp = assert(dl.load(function(a, b)
+		calls = calls + 1;
+		a, b = int(a), int(b);
+		return (a > b) and 1 or ((a < b) and -1 or 0);
+	end, I, { P, P }, "queue"));
+	local buf = dl.dlffi_Pointer(4 * dl.sizeof(I), true);
+	local v = buf:view(I, 4);
+	local function sorted()
+		local t = v:read();
+		return (t[1] == 1) and (t[2] == 2) and (t[3] == 3) and (t[4] == 4);
+	end;
+	-- the owner thread calls directly
+	v:write(1, { 3, 1, 4, 2 });
+	qsort(buf, 4, dl.sizeof(I), cmp);
+	assert(sorted() and (calls > 0));
+	-- a worker waits for dl.poll() to run each call
+	v:write(1, { 3, 1, 4, 2 });
+	calls = 0;
+	local f = assert(qsort:async(buf, 4, dl.sizeof(I), cmp));
+	local polled = 0;
+	while not f:ready() do polled = polled + dl.poll() end;
+	f:result();
+	assert(sorted() and (calls > 0) and (polled == calls));
+	-- posted calls do not wait, their return values are zeroed
+	calls = 0;
+	local post = assert(dl.load(function()
+		calls = calls + 1;
+		return 1;
+	end, I, { P, P }, "post"));
+	f = assert(qsort:async(buf, 4, dl.sizeof(I), post));
+	f:result();
+	assert(calls == 0);
+	assert((dl.poll() == calls) and (calls > 0));
+	assert(dl.poll() == 0);
+	assert(not pcall(dl.load, function() end, I, {}, "nowhere"));
+end });
+-- }}} queue
+
+-- {{{ async - calls running on worker threads
+table.insert(checks, { "async", function()
+	local I, P = dl.ffi_type_sint, dl.ffi_type_pointer;
+	local strlen = assert(dl.load(LIBC, "strlen", dl.ffi_type_size_t, { P }));
+	local usleep = assert(dl.load(LIBC, "usleep",
+		I, { dl.ffi_type_uint }));
+	assert(dl.async_workers() > 0);
+	local f = assert(strlen:async("hello"));
+	assert(f:result() == 5);
+	assert(f:ready() and (f:result() == 5));
+	f = assert(usleep:async(20000));
+	assert((f:await() == 0) and f:ready());
+	-- strings of cast tables are spilled and kept until the end
+	f = assert(strlen:async({ _val = "spilled string" }));
+	collectgarbage();
+	assert(f:result() == 14);
+	-- inside a coroutine await() yields the future
+	local co = coroutine.wrap(function()
+		return assert(strlen:async(string.rep("x", 1000))):await();
+	end);
+	local r = co();
+	while type(r) ~= "number" do r = co() end;
+	assert(r == 1000);
+	-- errors are returned
+	local e;
+	r, e = strlen:async();
+	assert((r == nil) and e:find("0 arguments"), e);
+	r, e = strlen:async(function() end);
+	assert((r == nil) and e, "a function is not a pointer");
+	local cb = assert(dl.load(function() return 0 end, I, {}));
+	r, e = cb:async();
+	assert((r == nil) and e:find("closure"), e);
+end });
+-- }}} async
+
+-- {{{ arena - short living buffers freed at once
+table.insert(checks, { "arena", function()
+	local I = dl.ffi_type_sint;
+	local strlen = assert(dl.load(LIBC, "strlen",
+		dl.ffi_type_size_t, { dl.ffi_type_pointer }));
+	local a = dl.arena(64);
+	local s, n = a:string("arena");
+	assert((n == 5) and (s:tostring() == "arena") and (strlen(s) == 5));
+	local p = assert(a:alloc(4 * dl.sizeof(I), dl.sizeof(I)));
+	assert(p:view(I, 4):write(1, { 1, 2, 3, 4 }) == 4);
+	assert(p:view(I, 4):read()[4] == 4);
+	-- allocations larger than a chunk get their own one
+	local big = assert(a:alloc(1000));
+	big:view(I, 250):write(250, { 7 });
+	assert(s:tostring() == "arena");
+	-- the current chunk is reused after reset()
+	a = dl.arena(64);
+	local first = a:alloc(8, 8):offset(0);
+	a:alloc(100);
+	a:reset();
+	assert(a:alloc(8, 8):offset(0) == first);
+	-- arenas keep the strings of cast tables
+	local sv = dl.dlffi_Pointer(dl.sizeof(dl.ffi_type_pointer), true)
+		:view(dl.ffi_type_pointer, 1);
+	assert(sv:write(1, { "kept" }, a) == 1);
+	collectgarbage();
+	assert(sv:tostrings()[1] == "kept");
+	-- errors
+	assert(not pcall(dl.arena, 0));
+	assert(not pcall(a.alloc, a, -1));
+	assert(not pcall(a.alloc, a, 8, 3));
+	assert(not pcall(a.string, a, {}));
+end });
+-- }}} arena
+
+-- {{{ stats - counters of the calls by symbol name
+table.insert(checks, { "stats", function()
+	local P, S = dl.ffi_type_pointer, dl.ffi_type_size_t;
+	local strlen = assert(dl.load(LIBC, "strlen", S, { P }));
+	local strnlen = assert(dl.load(LIBC, "strnlen",
+		S, { dl.ffi_type_cstring, S }));
+	dl.stats_reset();
+	dl.stats(true);
+	assert(strlen("abc") == 3);
+	assert(strnlen("abcdef", 10) == 6);
+	assert(strnlen("abcdef", 10) == 6);
+	local t = dl.stats(false);
+	assert((t.strlen.calls == 1) and (t.strnlen.calls == 2));
+	assert(t.strlen.time >= 0);
+	-- strings of ffi_type_cstring are borrowed, not copied
+	assert((t.strlen.strings == 4) and (t.strnlen.strings == 0));
+	-- disabled counters stay unchanged
+	strlen("abc");
+	assert(dl.stats().strlen.calls == 1);
+	dl.stats_reset();
+	assert(dl.stats().strlen == nil);
+end });
+-- }}} stats
+
+-- {{{ mysql - prepared statements of mysql.lua against a mock library
+table.insert(checks, { "mysql", function()
+	local P = dl.ffi_type_pointer;
+	local memcpy = assert(dl.load(LIBC, "memcpy",
+		P, { P, P, dl.ffi_type_size_t }));
+	local long = string.rep("x", 300);
+	local rows = {
+		{ 1, "short", 0.5 },
+		{ 2, long, nil },
+		{ 3, long .. "y", 2.0 },
+	};
+	local T, stmt, res, fields, params, results;
+	local fetched, seen, refetch = 0, {}, {};
+	local function bind(p, i)
+		return T:view("MYSQL_BIND", dl.dlffi_Pointer(p, false)
+			:index(i, T["MYSQL_BIND"]));
+	end;
+	local function put(kind, p, v)
+		T:view(kind, dl.dlffi_Pointer(p, false)).value = v;
+	end;
+	-- {{{ mock of libmysqlclient
+	local mock = {
+		mysql_init = function() return stmt end,
+		mysql_real_query = function() return 0 end,
+		mysql_store_result = function() return res end,
+		mysql_num_fields = function() return 2 end,
+		mysql_stmt_init = function() return stmt end,
+		mysql_stmt_prepare = function() return 0 end,
+		mysql_stmt_param_count = function() return 1 end,
+		mysql_stmt_field_count = function() return 3 end,
+		mysql_stmt_bind_param = function(_, p) params = p; return 0 end,
+		mysql_stmt_bind_result = function(_, p) results = p; return 0 end,
+		mysql_stmt_affected_rows = function() return 1 end,
+		mysql_stmt_execute = function()
+			local b = bind(params, 1);
+			seen[#seen + 1] = {
+				type = b.buffer_type, length = b.buffer_length,
+			};
+			fetched = 0;
+			return 0;
+		end,
+		mysql_stmt_result_metadata = function() return stmt end,
+		mysql_fetch_fields = function(p)
+			-- the result of a query has no fields
+			if p == res:offset(0) then return dl.NULL end;
+			fields = T:encode("MYSQL_FIELD", {
+				{ name = "id", name_length = 2, type = 8 },
+				{ name = "name", name_length = 4, type = 254 },
+				{ name = "score", name_length = 5, type = 5 },
+			});
+			return fields;
+		end,
+		mysql_stmt_fetch = function()
+			fetched = fetched + 1;
+			local row = rows[fetched];
+			if not row then return 100 end;
+			local truncated = 0;
+			for i = 1, 3, 1 do
+				local b = bind(results, i);
+				local v = row[i];
+				put("bool", b.is_null, (v == nil) and 1 or 0);
+				if i == 2 then
+					put("length", b.length, #v);
+					if #v > b.buffer_length then truncated = 101 end;
+					memcpy(b.buffer, v, math.min(#v, b.buffer_length));
+				elseif v ~= nil then
+					put(i == 1 and "integer" or "double", b.buffer, v);
+				end;
+			end;
+			return truncated;
+		end,
+		mysql_stmt_fetch_column = function(_, p, col)
+			local b = bind(p, 1);
+			local v = rows[fetched][col + 1];
+			refetch[#refetch + 1] = p;
+			assert((b.buffer_type == 254) and (b.buffer_length >= #v));
+			memcpy(b.buffer, v, #v);
+			return 0;
+		end,
+	};
+	-- }}} mock of libmysqlclient
+	local load = dl.load;
+	dl.load = function(lib, sym, ret, args, ...)
+		if lib ~= "libmysqlclient.so" then
+			return load(lib, sym, ret, args, ...);
+		end;
+		-- closures do not cast tables, objects pass their _val
+		local f = assert(load(mock[sym] or function() return 0 end,
+			ret, args));
+		return function(...)
+			local a = table.pack(...);
+			for i = 1, a.n, 1 do
+				if type(a[i]) == "table" then a[i] = a[i]._val end;
+			end;
+			return f(table.unpack(a, 1, a.n));
+		end;
+	end;
+	stmt, res = dl.dlffi_Pointer(64, true), dl.dlffi_Pointer(64, true);
+	local ok, m = pcall(require, "mysql");
+	dl.load = load;
+	package.loaded.mysql = nil;
+	assert(ok, m);
+	T = m.mysql_t;
+	-- MySQL 5.7 and 8.0 layout on LP64
+	if dl.sizeof(P) == 8 then
+		assert(dl.sizeof(T.MYSQL_BIND) == 112);
+		assert((dl.type_offset(T.MYSQL_BIND, "buffer_length") == 64) and
+			(dl.type_offset(T.MYSQL_BIND, "buffer_type") == 96) and
+			(dl.type_offset(T.MYSQL_BIND, "is_unsigned") == 101) and
+			(dl.type_offset(T.MYSQL_BIND, "extension") == 104));
+	end;
+	local sql = assert(m.Mysql:new());
+	local r, e = assert(sql:query("SELECT 1")):rows();
+	assert((r == nil) and e:find("mysql_fetch_fields"), e);
+	local st = assert(sql:prepare("SELECT id, name, score FROM t WHERE ?"));
+	r, e = st:execute();
+	assert((r == nil) and e:find("1 parameters"), e);
+	assert(st:execute("string") == 1);
+	assert(st:execute(7) == 1);
+	-- a number bind keeps no length of the string before
+	assert((seen[1].type == 254) and (seen[1].length == 6));
+	assert((seen[2].type == 8) and (seen[2].length == 0));
+	local row = assert(st:fetch());
+	assert((row.id == 1) and (row.name == "short") and (row.score == 0.5));
+	row = assert(st:fetch(row));
+	assert((row.id == 2) and (row.name == long) and (row.score == nil));
+	row = assert(st:fetch());
+	assert((row.id == 3) and (row.name == long .. "y") and (row.score == 2.0));
+	assert(st:fetch() == nil);
+	-- truncated strings are fetched again through the same bind
+	assert((#refetch == 2) and (refetch[1] == refetch[2]));
+end });
+-- }}} mysql
+
+-- {{{ outs - output arguments returned after the value
+table.insert(checks, { "outs", function()
+	local I, P, D = dl.ffi_type_sint, dl.ffi_type_pointer, dl.ffi_type_double;
+	local frexp, raw = assert(dl.load(LIBM, "frexp",
+		{ ret = D, 2 }, { D, I }));
+	local ok, m, e = frexp(8.0);
+	assert(ok and (m == 0.5) and (e == 4));
+	ok, m, e = frexp(8.0, dl.NULL);
+	assert(ok and (m == 0.5) and (e == 4));
+	assert(select(3, frexp(-3.0, 7)) == 2);
+	local modf = assert(dl.load(LIBM, "modf", { ret = D, 2 }, { D, D }));
+	ok, m, e = modf(2.75);
+	assert(ok and (m == 0.75) and (e == 2.0));
+	-- an output argument in the middle
+	local strtol = assert(dl.load(LIBC, "strtol",
+		{ ret = dl.ffi_type_slong, 2 }, { P, P, I }));
+	ok, m, e = strtol("123abc", dl.NULL, 10);
+	assert(ok and (m == 123) and (e ~= dl.NULL));
+	-- the original symbol is a function taking pointers
+	assert(getmetatable(raw) == getmetatable(frexp));
+	local exp = dl.dlffi_Pointer(dl.sizeof(I), true);
+	assert(raw(8.0, exp) == 0.5);
+	assert(exp:view(I, 1):read()[1] == 4);
+	-- errors
+	local r;
+	r, e = frexp(8.0, 1, 2);
+	assert((r == nil) and e:find("3 arguments"), e);
+	r, e = dl.load(LIBC, "strtol", { ret = dl.ffi_type_slong, 5 }, { P, P, I });
+	assert((r == nil) and e:find("does not exist"), e);
+	r, e = frexp:async(1.0);
+	assert((r == nil) and e:find("output arguments"), e);
+	r, e = frexp:map({ 1.0 });
+	assert((r == nil) and e:find("output arguments"), e);
+end });
+-- }}} outs
+
+-- {{{ cast - tables passed by their _val field or a cast function
+table.insert(checks, { "cast", function()
+	local I, P = dl.ffi_type_sint, dl.ffi_type_pointer;
+	local abs = assert(dl.load(LIBC, "abs", I, { I }));
+	assert(abs({ _val = -3 }) == 3);
+	assert(abs({ _val = { _val = -4 } }) == 4);
+	-- the field is read raw, nil, false and NULL are refused
+	local r, e = abs(setmetatable({}, { __index = { _val = -1 } }));
+	assert((r == nil) and e, "_val is not inherited");
+	r, e = abs({ _val = false });
+	assert((r == nil) and e, "false is not a value");
+	local strlen = assert(dl.load(LIBC, "strlen",
+		dl.ffi_type_size_t, { P }));
+	r, e = strlen({ _val = dl.NULL });
+	assert((r == nil) and e, "NULL is not a value");
+	-- objects of Dlffi:new() are passed by their _val too
+	local o = assert(dl.Dlffi:new({ { len = strlen } }, "hello"));
+	assert(o:len() == 5);
+	-- a field of another name
+	local absv = assert(dl.load(LIBC, "abs", I, { I }, "v"));
+	assert(absv({ v = -5 }) == 5);
+	r, e = absv({ _val = -5 });
+	assert((r == nil) and e, "_val is not the field");
+	-- a cast function, its errors are returned
+	local absf = assert(dl.load(LIBC, "abs", I, { I }, function(f, t)
+		return t.x * 2;
+	end));
+	assert(absf({ x = -2 }) == 4);
+	r, e = absf({});
+	assert((r == nil) and e, "the cast function raises");
+end });
+-- }}} cast
+
+-- {{{ class - methods of Dlffi:new() objects
+table.insert(checks, { "class", function()
+	local api = { get = function(o) return o._val end };
+	local inherited = setmetatable({}, { __index = { hidden = print } });
+	local spec = { make = true };
+	api.make = function(o) return o._val + 1 end;
+	local o = assert(dl.Dlffi:new({ api, inherited }, 1, nil, spec));
+	local other = assert(dl.Dlffi:new({ api, inherited }, 2, nil, spec));
+	assert(getmetatable(o) == getmetatable(other));
+	assert((o:get() == 1) and (other:get() == 2));
+	-- API tables are searched raw on every access
+	api.get = function(o) return -o._val end;
+	assert(o:get() == -1);
+	assert(o.hidden == nil);
+	-- constructors wrap their results into objects of the same class
+	local make = o.make;
+	assert(other.make == make);
+	local c = o:make();
+	assert((c._val == 2) and (getmetatable(c) == getmetatable(o)));
+	api.make = function(o) return o._val + 10 end;
+	assert((o.make ~= make) and (o:make()._val == 11));
+end });
+-- }}} class
+
+-- {{{ variadic - calls with inferred and declared variadic types
+table.insert(checks, { "variadic", function()
+	local I, P = dl.ffi_type_sint, dl.ffi_type_pointer;
+	local snprintf = assert(dl.load(LIBC, "snprintf",
+		I, { P, dl.ffi_type_size_t, P, "..." }));
+	local buf = dl.dlffi_Pointer(64, true);
+	-- integers are long, other numbers double, the rest pointers
+	assert(snprintf(buf, 64, "%ld %g %s|", 42, 1.5, "str") == 11);
+	assert(buf:tostring() == "42 1.5 str|");
+	assert(snprintf(buf, 64, "none") == 4);
+	assert(snprintf:vcall({ I, dl.ffi_type_double }, buf, 64,
+		"%d %.1f", 7, 2) == 5);
+	assert(buf:tostring() == "7 2.0");
+	-- more shapes than the cache holds
+	local v = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+	for k = 0, 9, 1 do
+		assert(snprintf(buf, 64, string.rep("%ld", k),
+			table.unpack(v, 1, k)) == k);
+	end;
+	assert((snprintf(buf, 64, "%ld", 5) == 1) and (buf:tostring() == "5"));
+	-- errors
+	local r, e = snprintf(buf);
+	assert((r == nil) and e:find("3 expected"), e);
+	r, e = snprintf(buf, 64, "%d", {});
+	assert((r == nil) and e, "a table without _val is refused");
+	r, e = snprintf:vcall({ I }, buf, 64, "%d");
+	assert((r == nil) and e:find("1 declared"), e);
+	r, e = snprintf:vcall({ dl.ffi_type_float }, buf, 64, "%f", 1);
+	assert((r == nil) and e:find("promoted"), e);
+	r, e = snprintf:vcall({ dl.ffi_type_schar }, buf, 64, "%d", 1);
+	assert((r == nil) and e:find("promoted"), e);
+	assert(not pcall(snprintf.vcall, snprintf, { "x" }, buf, 64, "%d", 1));
+	assert(not pcall(snprintf.vcall, snprintf, nil, buf, 64, ""));
+	local abs = assert(dl.load(LIBC, "abs", I, { I }));
+	r, e = abs:vcall({}, 1);
+	assert((r == nil) and e:find("variadic"), e);
+	r, e = snprintf:async(buf, 64, "x");
+	assert((r == nil) and e:find("variadic"), e);
+end });
+-- }}} variadic
+
+-- {{{ signatures - types declared by a letter each
+table.insert(checks, { "signatures", function()
+	local abs = assert(dl.load(LIBC, "abs", "i(i)"));
+	assert((abs(-3) == 3) and (abs({ _val = -2 }) == 2));
+	-- interned signatures are shared by the functions
+	local labs = assert(dl.load(LIBC, "labs", "l(l)"));
+	assert(labs(-(1 << 40)) == 1 << 40);
+	assert(dl.load(LIBC, "abs", "i(i)")(-1) == 1);
+	assert(dl.load(LIBM, "ldexp", "d(di)")(0.5, 3) == 4.0);
+	assert(dl.load(LIBC, "strlen", "z(s)")("abcd") == 4);
+	assert(dl.load(LIBC, "srand", "v(I)")(1) == nil);
+	local snprintf = assert(dl.load(LIBC, "snprintf", "i(pzp...)"));
+	local buf = dl.dlffi_Pointer(32, true);
+	assert(snprintf(buf, 32, "%ld-%s", 3, "x") == 3);
+	assert(buf:tostring() == "3-x");
+	assert(abs:async(-4):result() == 4);
+	-- the cast field follows the signature
+	assert(dl.load(LIBC, "abs", "i(i)", "v")({ v = -9 }) == 9);
+	local lib = assert(dl.Header.loadlib({
+		["_dlffi"] = { ["lib"] = { LIBC } },
+		{ { "abs", "i(i)" } },
+	}));
+	assert(lib[""].abs(-5) == 5);
+	-- errors
+	local r, e = dl.load(LIBC, "abs", "x(i)");
+	assert((r == nil) and e:find("unknown return type"), e);
+	r, e = dl.load(LIBC, "abs", "i(i");
+	assert((r == nil) and e:find("must look like"), e);
+	r, e = dl.load(LIBC, "abs", "i(v)");
+	assert((r == nil) and e:find("argument type #1"), e);
+	r, e = dl.load(LIBC, "abs", "i(iy)");
+	assert((r == nil) and e:find("argument type #2"), e);
+	r, e = dl.load(LIBC, "no_such_symbol_in_libc", "i(i)");
+	assert((r == nil) and e:find("no_such_symbol_in_libc"), e);
+end });
+-- }}} signatures
+
+-- {{{ strings - borrowed string arguments and string views
+table.insert(checks, { "strings", function()
+	local P, S = dl.ffi_type_pointer, dl.ffi_type_size_t;
+	local C = dl.ffi_type_cstring;
+	-- the Lua string itself is passed, not a copy
+	local strchr = assert(dl.load(LIBC, "strchr",
+		P, { C, dl.ffi_type_sint }));
+	local s = "hello world";
+	local w = strchr(s, string.byte("w"));
+	assert(dl.strview(w):equals("world"));
+	local strlen = assert(dl.load(LIBC, "strlen", S, { C }));
+	assert((strlen("xyz") == 3) and (strlen({ _val = "ab" }) == 2));
+	assert(dl.batch(strlen, 2, nil, { "a", "bcd" })[2] == 3);
+	-- views of foreign bytes
+	local buf = dl.dlffi_Pointer(16, true);
+	local strcpy = assert(dl.load(LIBC, "strcpy", P, { P, C }));
+	strcpy(buf, "abcdef");
+	local v = buf:strview();
+	assert((#v == 6) and (tostring(v) == "abcdef") and v:equals("abcdef"));
+	assert((v == buf:strview()) and (v:hash() == dl.strview(buf):hash()));
+	assert((buf:strview(3) < v) and (#buf:strview(3) == 3));
+	assert((v:sub(2, 3):tostring() == "bc") and (v:sub(-2):tostring() == "ef"));
+	assert(v:pointer() == buf:offset(0));
+	-- views are passed as their pointers
+	assert(strlen(v:sub(3)) == 4);
+	-- errors
+	assert(not pcall(dl.strview, nil));
+	assert(not pcall(dl.strview, dl.NULL));
+	assert(not pcall(buf.strview, buf, -1));
+	assert(not pcall(buf.strview, buf, 17));
+end });
+-- }}} strings
+
+-- {{{ mmap - memory mapped files
+table.insert(checks, { "mmap", function()
+	local I, P, S = dl.ffi_type_sint, dl.ffi_type_pointer, dl.ffi_type_size_t;
+	local path = os.tmpname();
+	local f = assert(io.open(path, "wb"));
+	f:write("0123456789");
+	f:close();
+	local memset = assert(dl.load(LIBC, "memset", P, { P, I, S }));
+	local m, n = assert(dl.mmap(path));
+	assert((n == 10) and (m:strview(n):tostring() == "0123456789"));
+	m, n = assert(dl.mmap(path, "r", 4));
+	assert((n == 6) and (m:strview(n):tostring() == "456789"));
+	-- read-only mappings are not written through dlffi
+	assert(not pcall(m:view(I, 1).write, m:view(I, 1), 1, { 1 }));
+	local abs = assert(dl.load(LIBC, "abs", I, { I }));
+	assert(not pcall(dl.batch, abs, 1, m, { 1 }));
+	-- private mappings are not written to the file
+	local c = assert(dl.mmap(path, "c"));
+	memset(c, string.byte("A"), 2);
+	assert(c:strview(10):tostring() == "AA23456789");
+	local r, e = c:msync();
+	assert((r == nil) and e:find("not writable"), e);
+	-- shared ones are
+	local w = assert(dl.mmap(path, "rw", 2, 3));
+	memset(w, string.byte("B"), 3);
+	assert(w:msync());
+	-- not unmapped under pending calls
+	local strnlen = assert(dl.load(LIBC, "strnlen", S, { P, S }));
+	local fut = assert(strnlen:async(w, 3));
+	r, e = w:munmap();
+	assert((r == nil) and e:find("pending"), e);
+	assert(fut:result() == 3);
+	assert(w:munmap());
+	assert(not pcall(w.munmap, w));
+	f = assert(io.open(path, "rb"));
+	assert(f:read("a") == "01BBB56789");
+	f:close();
+	-- the range must be within the file
+	r, e = dl.mmap(path, "r", 4, 7);
+	assert((r == nil) and e:find("length beyond"), e);
+	r, e = dl.mmap(path, "r", 0, 1 << 40);
+	assert((r == nil) and e:find("length beyond"), e);
+	r, e = dl.mmap(path, "r", 11);
+	assert((r == nil) and e:find("offset beyond"), e);
+	r, e = dl.mmap(path, "r", 10);
+	assert((r == nil) and e:find("nothing to map"), e);
+	assert(not pcall(dl.mmap, path, "r", -1));
+	assert(not pcall(dl.mmap, path, "x"));
+	os.remove(path);
+	r, e = dl.mmap(path);
+	assert((r == nil) and e:find("open"), e);
+end });
+-- }}} mmap
+
+-- }}} dlffi checks
 
 function main()
 	-- run a constructor
@@ -142,5 +908,14 @@ print("hard:", dl.type_element(buf, struct["rlimit"], 2));
 	until false;
 end;
 
-main();
+for _, v in ipairs(checks) do
+	v[2]();
+	print("dlffi", v[1], "ok");
+end;
+
+if (not arg) or (arg[1] ~= "dlffi") then
+	mysql = require("mysql");
+	assert(type(mysql) == "table", "MySQL module loading error");
+	main();
+end;
 